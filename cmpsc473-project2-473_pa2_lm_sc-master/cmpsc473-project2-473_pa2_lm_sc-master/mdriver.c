@@ -9,6 +9,7 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
 #include <setjmp.h>
 #include <signal.h>
@@ -19,7 +20,11 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -34,6 +39,11 @@
 /* Misc */
 #define MAXLINE     1024          /* max string size */
 #define HDRLINES       4          /* number of header lines in a trace file */
+#define BATCH_MAX     64          /* max requests in one batch call (-b) */
+#define SHORT_LIFETIME 1000       /* requests before its free that make a block short-lived (-L) */
+#define TRACE_MAGIC "MMTRACE1"    /* first bytes of a binary trace file */
+#define TRACE_VERSION 1           /* version of the hints in a binary trace file, bumped when parse_trace() changes them */
+#define TRACE_CACHE ".bin"        /* suffix of the binary copy of a text trace file */
 #define LINENUM(i) (i+HDRLINES+1) /* cnvt trace request nums to linenums (origin 1) */
 
 #ifndef REF_ONLY
@@ -78,13 +88,35 @@ typedef struct {
     tree_t *lo_tree;
 } range_set_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/* Types of trace operations */
+enum { ALLOC, FREE, REALLOC };
+
+/*
+ * Characterizes a single trace operation (allocator request). Every
+ * field has a fixed width, so a binary trace file is an array of them
+ */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    long index;                         /* index for free() to use later */
-    size_t size;                        /* byte size of alloc/realloc request */
+    int32_t type;                       /* type of request */
+    int32_t hint;                       /* MM_SHORT or MM_LONG for an alloc, by when it is freed */
+    int64_t index;                      /* index for free() to use later */
+    uint64_t size;                      /* byte size of alloc/realloc request */
 } traceop_t;
 
+/*
+ * The header of a binary trace file, followed by num_ops requests.
+ * The file is mapped, and the requests are used where they lie
+ */
+typedef struct {
+    char magic[8];        /* TRACE_MAGIC */
+    uint32_t op_bytes;    /* sizeof(traceop_t), to reject other layouts */
+    uint32_t version;     /* TRACE_VERSION, to reject hints made another way */
+    int32_t lifetime;     /* SHORT_LIFETIME that the hints were made with */
+    int32_t weight;       /* weight for this trace */
+    int32_t num_ids;      /* number of alloc/realloc ids */
+    int32_t num_ops;      /* number of distinct requests */
+    uint64_t data_bytes;  /* peak number of data bytes allocated during trace */
+} trace_header_t;
+
 /* Holds the information for one trace file */
 typedef struct {
     char filename[MAXLINE];
@@ -93,6 +125,8 @@ typedef struct {
     int num_ops;          /* number of distinct requests */
     weight_t weight;      /* weight for this trace */
     traceop_t *ops;       /* array of requests */
+    void *map;            /* mapped binary trace file holding ops, or NULL if ops was malloc'd */
+    size_t map_bytes;     /* size of that mapping */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
@@ -121,10 +155,26 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    double rss;        /* peak resident set in KB while measuring util (always 0 for libc) */
+    double heap;       /* peak heap in KB while measuring util (always 0 for libc) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* The result of one trace under -j, in memory shared with its worker */
+typedef struct {
+    stats_t stats;
+    int errors;        /* number of errs the worker found */
+    bool done;         /* did the worker get to the end of the trace? */
+    int phases;        /* number of bytes of phase_token the worker holds */
+} job_t;
+
+/* The memory that the workers of -j share with the driver */
+typedef struct {
+    pid_t speed_holder; /* the worker holding the byte of speed_token, or 0 */
+    job_t job[];        /* one for each trace */
+} pool_t;
+
 /* Summarizes the key statistics for a set of traces */
 typedef struct {
     double util;  /* average utilization expressed as a percentage */
@@ -160,6 +210,18 @@ int verbose = REF_ONLY ? 0 : 1;  /* global flag for verbose output */
 static int errors = 0;           /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static bool batch_mode = false;   /* Replay runs of requests through the batch calls */
+static int compare_mask = 0;      /* The configurations of mm.c to compare in a matrix (-P, -B) */
+static int compact_every = 0;     /* Requests between two mm_compact() calls of the utilization phase, through handles (-H) */
+static bool use_hints = false;    /* Pass the lifetimes of the trace to mm_malloc_hint() in the utilization phase */
+static bool use_cache = true;     /* Keep a binary copy of each text trace file, and map it (-R turns it off) */
+static int jobs = 1;              /* Number of traces evaluated at once, each in a worker process (-j) */
+static bool overlap_speed = false; /* Let the workers of -j run while another one times its trace (-p) */
+static int speed_token[2] = { -1, -1 }; /* Pipe holding the one byte that a worker of -j holds while it times */
+static int phase_token[2] = { -1, -1 }; /* Pipe holding a byte for each worker of -j, held while it does not time */
+static pool_t *pool = NULL;       /* The results of the workers of -j */
+static job_t *worker_job = NULL;  /* The job of this process, if it is a worker of -j */
+static FILE *stats_file = NULL;   /* CSV file of the allocator statistics of each trace (-C) */
 static size_t maxfill = MAXFILL;
 
 /* by default, no timeouts */
@@ -207,6 +269,11 @@ static void randomize_block(trace_t *trace, int index);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
+static bool map_trace(trace_t *trace, const char *path);
+static bool check_ops(const trace_t *trace);
+static void parse_trace(trace_t *trace);
+static bool cache_fresh(const char *path, const char *cache);
+static void write_trace(const trace_t *trace, const char *cache);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
@@ -217,8 +284,14 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, double *heap);
+static void **handle_realloc(void **handle, size_t oldsize, size_t size);
+static void print_stats_csv(const trace_t *trace, const char *phase,
+                            const struct mm_stats *stats);
+static void reset_peak_rss(void);
+static double peak_rss(void);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_speed_batch(void *ptr);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
@@ -242,68 +315,488 @@ static void timeout_handler(int sig __attribute__((unused))) {
 /* Compute throughput from reference implementation */
 static double measure_ref_throughput();
 
+/* Evaluate the traces, one after another or in worker processes */
+static bool run_trace(int i, const char *tracedir, const char *tracefile,
+                      stats_t *stats, speed_t *speed_params);
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles,
+                               stats_t *mm_stats, speed_t *speed_params);
+static void run_worker(int i, const char *tracedir, const char *tracefile,
+                       speed_t *speed_params, time_t deadline)
+    __attribute__((noreturn));
+static void speed_lock(void);
+static void speed_unlock(void);
+static void phase_lock(void);
+static void phase_unlock(void);
+static void token_take(int fd);
+static void token_give(int fd, int n);
+
+/* Compare the backends and placement policies of mm.c */
+static void run_configs(int num_tracefiles, const char *tracedir,
+                        char **tracefiles, speed_t *speed_params);
+
 /*
  * Run the tests; return the number of tests run (may be less than
- * num_tracefiles, if there's a timeout)
+ * num_tracefiles, if there's a timeout). With -j, the traces are
+ * evaluated by worker processes instead
  */
 static void run_tests(int num_tracefiles, const char *tracedir,
                       char **tracefiles, 
                       stats_t *mm_stats, speed_t *speed_params) {
-    volatile int i;
+    int i;
 
+    if (jobs > 1 && num_tracefiles > 1 && !onetime_flag) {
+        run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats,
+                           speed_params);
+        return;
+    }
     for (i=0; i < num_tracefiles; i++) {
-        /* initialize simulated memory system in memlib.c *
-         * start each trace with a clean system */
-        mem_init();
-        range_set_t *ranges = new_range_set();
+        if (!run_trace(i, tracedir, tracefiles[i], &mm_stats[i], speed_params))
+            return;
+    }
+}
 
+/*
+ * run_trace - Check the correctness, utilization and throughput of
+ * mm.c on trace number i, in a clean memory system. Return false if
+ * -c asked for the correctness check only
+ */
+static bool run_trace(int i, const char *tracedir, const char *tracefile,
+                      stats_t *stats, speed_t *speed_params) {
+    /* initialize simulated memory system in memlib.c *
+     * start each trace with a clean system */
+    mem_init();
+    range_set_t *ranges = new_range_set();
 
-        // NOTE: If times out, then it will reread the trace file 
 
-        trace_t *trace;
-        trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
-        strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+    // NOTE: If times out, then it will reread the trace file 
 
-        /* Prepare for timeout */
-        if (setjmp(timeout_jmpbuf) != 0) {
-            mm_stats[i].valid = false;
-        } else {
-            if (verbose > 1)
-                printf("Checking mm_malloc for correctness, ");
-            mm_stats[i].valid =
-                /* Do 2 tests, since may fail to reinitialize properly */
-                eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
-
-            if (onetime_flag) {
-                free_trace(trace);
-                return;
-            }
-        }
-        if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
-            speed_params->trace = trace;
-            speed_params->ranges = ranges;
-            if (verbose > 1)
-                printf("and performance.\n");
-            mm_stats[i].secs = fsec(eval_mm_speed, speed_params);
+    trace_t *trace;
+    trace = read_trace(stats, tracedir, tracefile);
+    strcpy(stats->filename, trace->filename);
+    stats->ops = trace->num_ops;
+
+    /* Prepare for timeout */
+    if (setjmp(timeout_jmpbuf) != 0) {
+        stats->valid = false;
+        speed_unlock();
+    } else {
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness, ");
+        stats->valid =
+            /* Do 2 tests, since may fail to reinitialize properly */
+            eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
+
+        if (onetime_flag) {
+            free_trace(trace);
+            return false;
         }
+    }
+    if (stats->valid) {
+        if (verbose > 1)
+            printf("efficiency, ");
+        /* Give the pages of the validity runs back, so the peak
+           resident set is the one of this trace alone */
+        mem_trim(mem_heapsize());
+        reset_peak_rss();
+        stats->util = eval_mm_util(trace, i, &stats->heap);
+        stats->rss = peak_rss();
+        speed_params->trace = trace;
+        speed_params->ranges = ranges;
+        if (verbose > 1)
+            printf("and performance.\n");
+        speed_lock();
+        stats->secs = fsec(batch_mode ? eval_mm_speed_batch : eval_mm_speed,
+                           speed_params);
+        speed_unlock();
+    }
 
 #if 0
-        printf(" %d operations.  %ld comparisons.  Avg = %.1f\n",
-               trace->num_ops, ranges->lo_tree->comparison_count,
-               (double) ranges->lo_tree->comparison_count / trace->num_ops);
+    printf(" %d operations.  %ld comparisons.  Avg = %.1f\n",
+           trace->num_ops, ranges->lo_tree->comparison_count,
+           (double) ranges->lo_tree->comparison_count / trace->num_ops);
 #endif
-        free_trace(trace);
-        free_range_set(ranges);
+    free_trace(trace);
+    free_range_set(ranges);
+
+    /* clean up memory system */
+    mem_deinit();
+    return true;
+}
+
+/*
+ * run_tests_parallel - Evaluate every trace in a worker process of its
+ * own, with at most jobs of them running at once. The workers return
+ * their stats through shared memory. Unless -p, a worker holds one of
+ * the jobs bytes in phase_token for all but the throughput phase, and
+ * times its trace only while it holds the one byte in speed_token and
+ * every byte in phase_token, so nothing else runs while a trace is
+ * timed. The timeout of -s stays one deadline for the whole run
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles,
+                               stats_t *mm_stats, speed_t *speed_params) {
+    size_t bytes = sizeof(pool_t) + num_tracefiles * sizeof(job_t);
+    unsigned remaining = alarm(0);
+    time_t deadline = time(NULL) + remaining;
+    int running = 0, next = 0, i, status;
+    pid_t pid, *pids;
+
+    pool = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED)
+        unix_error("mmap failed in run_tests_parallel");
+    if ((pids = (pid_t *)calloc(num_tracefiles, sizeof(pid_t))) == NULL)
+        unix_error("pids calloc in run_tests_parallel failed");
+    if (!overlap_speed) {
+        if (pipe(speed_token) < 0 || pipe(phase_token) < 0)
+            unix_error("pipe failed in run_tests_parallel");
+        token_give(speed_token[1], 1);
+        token_give(phase_token[1], jobs);
+    }
+
+    /* The workers write their CSV rows through the same file */
+    if (stats_file != NULL)
+        fflush(stats_file);
+
+    while (next < num_tracefiles || running > 0) {
+        /* Start another worker, if there is room for one */
+        if (next < num_tracefiles && running < jobs) {
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in run_tests_parallel");
+            if (pid == 0)
+                run_worker(next, tracedir, tracefiles[next], speed_params,
+                           remaining ? deadline : 0);
+            pids[next++] = pid;
+            running++;
+            continue;
+        }
+
+        /* Wait for one to finish */
+        if ((pid = wait(&status)) < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("wait failed in run_tests_parallel");
+        }
+        for (i = 0; i < next && pids[i] != pid; i++)
+            ;
+        if (i == next)
+            continue;
+        running--;
+
+        /* A worker that died took no stats with it, and maybe tokens */
+        if (!pool->job[i].done) {
+            fprintf(stderr, "The worker for %s died before it finished\n",
+                    tracefiles[i]);
+            strcpy(pool->job[i].stats.filename, tracedir);
+            strcat(pool->job[i].stats.filename, tracefiles[i]);
+            pool->job[i].stats.valid = false;
+            pool->job[i].errors++;
+            if (speed_token[0] >= 0) {
+                token_give(phase_token[1], pool->job[i].phases);
+                pool->job[i].phases = 0;
+            }
+            if (pool->speed_holder == pid) {
+                pool->speed_holder = 0;
+                token_give(speed_token[1], 1);
+            }
+        }
+    }
+
+    for (i = 0; i < num_tracefiles; i++) {
+        mm_stats[i] = pool->job[i].stats;
+        errors += pool->job[i].errors;
+    }
+
+    if (speed_token[0] >= 0) {
+        close(speed_token[0]);
+        close(speed_token[1]);
+        close(phase_token[0]);
+        close(phase_token[1]);
+        speed_token[0] = speed_token[1] = -1;
+        phase_token[0] = phase_token[1] = -1;
+    }
+    munmap(pool, bytes);
+    pool = NULL;
+    free(pids);
+
+    /* Resume the timeout of the driver */
+    if (remaining)
+        alarm(deadline > time(NULL) ? deadline - time(NULL) : 1);
+}
+
+/*
+ * run_worker - Evaluate trace number i in a worker process of -j, and
+ * exit. The CSV rows of the trace are gathered in memory, and written
+ * with one write(), so they do not interleave with the rows of the
+ * other workers. The worker waits for its byte of phase_token before
+ * the timeout starts, since nothing catches it until run_trace
+ */
+static void run_worker(int i, const char *tracedir, const char *tracefile,
+                       speed_t *speed_params, time_t deadline) {
+    job_t *job = &pool->job[i];
+    FILE *csv = stats_file;
+    char *rows = NULL;
+    size_t len = 0;
+
+    worker_job = job;
+    phase_lock();
+    if (deadline)
+        alarm(deadline > time(NULL) ? deadline - time(NULL) : 1);
+    if (csv != NULL && (stats_file = open_memstream(&rows, &len)) == NULL)
+        unix_error("open_memstream failed in run_worker");
+
+    errors = 0;
+    run_trace(i, tracedir, tracefile, &job->stats, speed_params);
+    job->errors = errors;
+
+    if (csv != NULL) {
+        fclose(stats_file);
+        if (write(fileno(csv), rows, len) != (ssize_t)len)
+            unix_error("write failed in run_worker");
+    }
+    phase_unlock();
+    job->done = true;
+    _exit(0);
+}
+
+/*
+ * speed_lock - Under -j, give back the byte of phase_token, wait for
+ * the token that lets a worker time its trace, and then for every
+ * byte of phase_token, so the other workers are all waiting. It does
+ * nothing otherwise
+ */
+static void speed_lock(void) {
+    if (speed_token[0] < 0)
+        return;
+    phase_unlock();
+    token_take(speed_token[0]);
+    pool->speed_holder = getpid();
+    while (worker_job->phases < jobs) {
+        token_take(phase_token[0]);
+        worker_job->phases++;
+    }
+}
+
+/*
+ * speed_unlock - Give the token back, if this worker holds it, and all
+ * the bytes of phase_token but the one for the rest of the trace
+ */
+static void speed_unlock(void) {
+    if (speed_token[0] < 0 || pool->speed_holder != getpid())
+        return;
+    if (worker_job->phases > 1) {
+        token_give(phase_token[1], worker_job->phases - 1);
+        worker_job->phases = 1;
+    }
+    pool->speed_holder = 0;
+    token_give(speed_token[1], 1);
+}
+
+/*
+ * phase_lock - Under -j, wait for a byte of phase_token, which the
+ * worker holds while it runs anything but a throughput phase. The
+ * token of speed_token is taken on the way, so a worker waiting to
+ * time its trace is not overtaken. It does nothing otherwise, or if
+ * the worker holds a byte already
+ */
+static void phase_lock(void) {
+    if (speed_token[0] < 0 || worker_job->phases > 0)
+        return;
+    token_take(speed_token[0]);
+    pool->speed_holder = getpid();
+    token_take(phase_token[0]);
+    worker_job->phases = 1;
+    pool->speed_holder = 0;
+    token_give(speed_token[1], 1);
+}
+
+/*
+ * phase_unlock - Give back the bytes of phase_token this worker holds
+ */
+static void phase_unlock(void) {
+    if (speed_token[0] < 0)
+        return;
+    token_give(phase_token[1], worker_job->phases);
+    worker_job->phases = 0;
+}
+
+/*
+ * token_take - Read one byte from the pipe of a token, waiting for it
+ */
+static void token_take(int fd) {
+    char token;
 
-        /* clean up memory system */
-        mem_deinit();
+    while (read(fd, &token, 1) != 1) {
+        if (errno != EINTR)
+            unix_error("read failed in token_take");
     }
 }
 
+/*
+ * token_give - Write n bytes into the pipe of a token
+ */
+static void token_give(int fd, int n) {
+    char token = 0;
+
+    while (n-- > 0) {
+        if (write(fd, &token, 1) != 1)
+            unix_error("write failed in token_give");
+    }
+}
+
+/*
+ * The configurations of mm.c that -P, -B and -L compare: segregated fit
+ * with each placement policy, the buddy backend, and best fit with the
+ * lifetimes kept apart, as mm.c guesses them or as the trace tells them
+ */
+#define COMPARE_POLICIES 0x1f   /* -P: every placement policy */
+#define COMPARE_BACKENDS 0x21   /* -B: best fit and the buddy backend */
+#define COMPARE_LIFETIMES 0xc1  /* -L: best fit with and without the lifetimes apart */
+#define NUM_CONFIGS 8
+
+static const struct {
+    const char *name;
+    int backend;
+    int policy;
+    bool lifetimes;  /* mm_set_lifetimes() */
+    bool hints;      /* mm_malloc_hint() with the lifetimes of the trace */
+} configs[NUM_CONFIGS] = {
+    { "best",    MM_SEGREGATED, MM_BEST_FIT,    false, false },
+    { "first",   MM_SEGREGATED, MM_FIRST_FIT,   false, false },
+    { "next",    MM_SEGREGATED, MM_NEXT_FIT,    false, false },
+    { "address", MM_SEGREGATED, MM_ADDRESS_FIT, false, false },
+    { "good",    MM_SEGREGATED, MM_GOOD_FIT,    false, false },
+    { "buddy",   MM_BUDDY,      MM_BEST_FIT,    false, false },
+    { "guessed", MM_SEGREGATED, MM_BEST_FIT,    true,  false },
+    { "hinted",  MM_SEGREGATED, MM_BEST_FIT,    true,  true },
+};
+
+/*
+ * run_configs - Run every trace under each configuration of mm.c in
+ * compare_mask and print the utilization and throughput of each pair as
+ * a matrix, with the averages that main computes for the score in the
+ * last row. When the lifetimes are compared, a second matrix has the
+ * peak heap of each pair, with the totals in the last row
+ */
+static void run_configs(int num_tracefiles, const char *tracedir,
+                        char **tracefiles, speed_t *speed_params) {
+    stats_t *stats[NUM_CONFIGS] = { NULL };
+    int c, i;
+
+    for (c = 0; c < NUM_CONFIGS; c++) {
+        if (!(compare_mask >> c & 1))
+            continue;
+        if (verbose > 1)
+            printf("\nTesting mm malloc with %s\n", configs[c].name);
+        stats[c] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+        if (stats[c] == NULL)
+            unix_error("stats calloc in run_configs failed");
+        mm_set_backend(configs[c].backend);
+        mm_set_policy(configs[c].policy);
+        mm_set_lifetimes(configs[c].lifetimes);
+        use_hints = configs[c].hints;
+        run_tests(num_tracefiles, tracedir, tracefiles, stats[c], speed_params);
+    }
+    mm_set_backend(MM_SEGREGATED);
+    mm_set_policy(MM_BEST_FIT);
+    mm_set_lifetimes(false);
+    use_hints = false;
+
+    /* One row per trace, with the utilization and Kops of each configuration */
+    if (tab_mode) {
+        printf("trace");
+        for (c = 0; c < NUM_CONFIGS; c++)
+            if (stats[c])
+                printf("\t%s_util\t%s_kops", configs[c].name, configs[c].name);
+        printf("\n");
+    } else {
+        printf("\nBackends, placement policies and lifetimes (util%% Kops):\n%-32s", "trace");
+        for (c = 0; c < NUM_CONFIGS; c++)
+            if (stats[c])
+                printf(" %15s", configs[c].name);
+        printf("\n");
+    }
+    for (i = 0; i < num_tracefiles; i++) {
+        printf(tab_mode ? "%s" : "%-32s", tracefiles[i]);
+        for (c = 0; c < NUM_CONFIGS; c++) {
+            stats_t *st;
+            if (!stats[c])
+                continue;
+            st = &stats[c][i];
+            if (!st->valid)
+                printf(tab_mode ? "\t-\t-" : " %15s", "-");
+            else if (tab_mode)
+                printf("\t%.1f\t%.0f", st->util * 100.0, st->ops * 1e-3 / st->secs);
+            else
+                printf("  %6.1f%% %6.0f", st->util * 100.0, st->ops * 1e-3 / st->secs);
+        }
+        printf("\n");
+    }
+
+    /* The averages, weighted like the score */
+    printf(tab_mode ? "%s" : "%-32s", "average");
+    for (c = 0; c < NUM_CONFIGS; c++) {
+        double secs = 0, ops = 0, util = 0;
+        int util_weight = 0;
+        bool valid = true;
+        if (!stats[c])
+            continue;
+        for (i = 0; i < num_tracefiles; i++) {
+            stats_t *st = &stats[c][i];
+            valid = valid && st->valid;
+            if (st->weight == WALL || st->weight == WPERF) {
+                secs += st->secs;
+                ops += st->ops;
+            }
+            if (st->weight == WALL || st->weight == WUTIL) {
+                util += st->util;
+                util_weight++;
+            }
+        }
+        util = util_weight ? util / util_weight : 0;
+        ops = secs ? ops / secs * 1e-3 : 0;
+        if (!valid)
+            printf(tab_mode ? "\t-\t-" : " %15s", "-");
+        else if (tab_mode)
+            printf("\t%.1f\t%.0f", util * 100.0, ops);
+        else
+            printf("  %6.1f%% %6.0f", util * 100.0, ops);
+    }
+    printf("\n");
+
+    /* One row per trace, with the peak heap of each configuration */
+    if (compare_mask & COMPARE_LIFETIMES & ~COMPARE_POLICIES) {
+        double total[NUM_CONFIGS] = { 0 };
+        printf(tab_mode ? "trace" : "\nPeak heap (KB):\n%-32s", "trace");
+        for (c = 0; c < NUM_CONFIGS; c++)
+            if (stats[c])
+                printf(tab_mode ? "\t%s_heap" : " %15s", configs[c].name);
+        printf("\n");
+        for (i = 0; i < num_tracefiles; i++) {
+            printf(tab_mode ? "%s" : "%-32s", tracefiles[i]);
+            for (c = 0; c < NUM_CONFIGS; c++) {
+                if (!stats[c])
+                    continue;
+                if (!stats[c][i].valid)
+                    printf(tab_mode ? "\t-" : " %15s", "-");
+                else
+                    printf(tab_mode ? "\t%.0f" : " %15.0f", stats[c][i].heap);
+                total[c] += stats[c][i].heap;
+            }
+            printf("\n");
+        }
+        printf(tab_mode ? "%s" : "%-32s", "total");
+        for (c = 0; c < NUM_CONFIGS; c++)
+            if (stats[c])
+                printf(tab_mode ? "\t%.0f" : " %15.0f", total[c]);
+        printf("\n");
+    }
+
+    for (c = 0; c < NUM_CONFIGS; c++)
+        free(stats[c]);
+}
+
 double score_component(double perf, double min_perf, double max_perf)
 {
     if (perf < min_perf) {
@@ -356,7 +849,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:j:s:t:v:C:H:hOVlDTbpPBLR")) != EOF) {
         switch (c) {
 
             case 'f': /* Use one specific trace file only (relative to curr dir) */
@@ -402,10 +895,53 @@ int main(int argc, char **argv)
                 set_timeout = atoi(optarg);
                 break;
 
+            case 'j': /* Evaluate this many traces at once, in worker processes */
+                jobs = atoi(optarg);
+                if (jobs < 1)
+                    jobs = 1;
+                break;
+
+            case 'p': /* Let the workers of -j run while another one times its trace */
+                overlap_speed = true;
+                break;
+
             case 'T':
                 tab_mode = true;
                 break;
 
+            case 'b':
+                batch_mode = true;
+                break;
+
+            case 'P': /* Compare every placement policy in a matrix */
+                compare_mask |= COMPARE_POLICIES;
+                break;
+
+            case 'B': /* Compare the buddy backend with segregated fit in a matrix */
+                compare_mask |= COMPARE_BACKENDS;
+                break;
+
+            case 'L': /* Compare the peak heap with and without the lifetimes apart */
+                compare_mask |= COMPARE_LIFETIMES;
+                break;
+
+            case 'R': /* Parse the text trace files every time, without binary copies */
+                use_cache = false;
+                break;
+
+            case 'H': /* Allocate through handles and compact in the utilization phase */
+                compact_every = atoi(optarg);
+                if (compact_every < 0)
+                    compact_every = 0;
+                break;
+
+            case 'C': /* Write the allocator statistics of each trace as CSV */
+                stats_file = fopen(optarg, "w");
+                if (stats_file == NULL)
+                    unix_error("Could not open %s in main", optarg);
+                fprintf(stats_file, "trace,phase,metric,value\n");
+                break;
+
             case 'h': /* Print this message */
                 usage(argv[0]);
                 exit(0);
@@ -485,6 +1021,17 @@ int main(int argc, char **argv)
 
 #endif
 
+    /*
+     * Optionally compare the configurations instead of scoring one
+     */
+    if (compare_mask) {
+        run_configs(num_global_tracefiles, tracedir, global_tracefiles,
+                    &speed_params);
+        if (stats_file != NULL)
+            fclose(stats_file);
+        exit(0);
+    }
+
     /*
      * Always run and evaluate the student's mm package
      */
@@ -499,6 +1046,9 @@ int main(int argc, char **argv)
     run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
               &speed_params);
 
+    if (stats_file != NULL)
+        fclose(stats_file);
+
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -894,19 +1444,17 @@ static bool check_index(const trace_t *trace, int opnum, int index, int realloc)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A binary trace
+ *              file, or the binary copy of a text one, is mapped and its
+ *              requests are used in place; a text trace file is parsed
+ *              and, unless -R, copied to <file>.bin for the next time.
+ *              A copy whose hints were made another way is stale too
  */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index;
-    size_t size;
-    int max_index = 0;
-    int op_index;
-    int ignore = 0;
+    char cache[MAXLINE + sizeof(TRACE_CACHE)];
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -915,9 +1463,135 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
-    /* Read the trace file header */
+    /* Map the trace file if it is binary, or its binary copy if that is
+       newer than the text; parse the text otherwise */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
+    sprintf(cache, "%s%s", trace->filename, TRACE_CACHE);
+    if (!map_trace(trace, trace->filename) &&
+        !(use_cache && cache_fresh(trace->filename, cache) && map_trace(trace, cache))) {
+        parse_trace(trace);
+        if (use_cache)
+            write_trace(trace, cache);
+    }
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+
+    /* and, if we're debugging, the offset into the random data */
+    if ((trace->block_rand_base =
+         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
+        unix_error("malloc 5 failed in read_trace");
+
+    /* fill in the stats */
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = trace->num_ops;
+
+    return trace;
+}
+
+/*
+ * map_trace - map a binary trace file, and point ops at its requests.
+ *             Return false if the file is not a binary trace of this
+ *             layout, has hints made another way, is cut short, or has
+ *             a request that is out of range
+ */
+static bool map_trace(trace_t *trace, const char *path)
+{
+    trace_header_t header;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return false;
+    if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.op_bytes != sizeof(traceop_t) || header.version != TRACE_VERSION ||
+        header.lifetime != SHORT_LIFETIME || header.num_ops < 0 ||
+        header.num_ids < 0 || fstat(fd, &st) < 0 ||
+        (size_t)st.st_size != sizeof(header) + header.num_ops * sizeof(traceop_t)) {
+        close(fd);
+        return false;
+    }
+
+    /* Fault the requests in now, rather than in the timed runs */
+    trace->map_bytes = st.st_size;
+    trace->map = mmap(NULL, trace->map_bytes, PROT_READ,
+                      MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (trace->map == MAP_FAILED)
+        unix_error("mmap failed in map_trace for %s", path);
+
+    if (((unsigned int)header.weight) > 3u)
+        app_error("%s: weight can only be in {0, 1, 2 3}", path);
+    trace->weight = header.weight;
+    trace->num_ids = header.num_ids;
+    trace->num_ops = header.num_ops;
+    trace->data_bytes = header.data_bytes;
+    trace->ops = (traceop_t *)((char *)trace->map + sizeof(header));
+
+    /* The requests index the arrays of blocks directly, so check them once */
+    if (!check_ops(trace)) {
+        munmap(trace->map, trace->map_bytes);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * check_ops - are the requests of a mapped trace ones that parse_trace()
+ *             could have made? Every alloc and realloc names an id below
+ *             num_ids, and every free one too, or -1 for free(NULL)
+ */
+static bool check_ops(const trace_t *trace)
+{
+    int i;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        const traceop_t *op = &trace->ops[i];
+        switch (op->type) {
+            case ALLOC:
+            case REALLOC:
+                if (op->index < 0 || op->index >= trace->num_ids)
+                    return false;
+                break;
+            case FREE:
+                if (op->index < -1 || op->index >= trace->num_ids)
+                    return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * parse_trace - parse the requests of a text trace file into ops, and
+ *               hint each alloc with its lifetime
+ */
+static void parse_trace(trace_t *trace)
+{
+    FILE *tracefile;
+    char type[MAXLINE];
+    int index;
+    size_t size;
+    int max_index = 0;
+    int op_index;
+    int ignore = 0;
+
+    trace->map = NULL;
+    trace->map_bytes = 0;
+
+    /* Read the trace file header */
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
@@ -937,22 +1611,6 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
          (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks =
-         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
-        unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes =
-         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
-
-    /* and, if we're debugging, the offset into the random data */
-    if ((trace->block_rand_base =
-         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
-        unix_error("malloc 5 failed in read_trace");
-
-
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
@@ -976,6 +1634,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
                 ignore += fscanf(tracefile, "%u", &index);
                 trace->ops[op_index].type = FREE;
                 trace->ops[op_index].index = index;
+                trace->ops[op_index].size = 0;
                 break;
             default:
                 app_error("Bogus type character (%c) in tracefile %s\n",
@@ -988,12 +1647,73 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
-    /* fill in the stats */
-    strcpy(stats->filename, trace->filename);
-    stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+    /* Hint each alloc with its lifetime: short when it is freed within
+       SHORT_LIFETIME requests, long otherwise. A realloc keeps the block alive */
+    int *born;
+    if ((born = (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
+    for (index = 0; index < trace->num_ids; index++)
+        born[index] = -1;
+    for (op_index = 0; op_index < trace->num_ops; op_index++) {
+        traceop_t *op = &trace->ops[op_index];
+        op->hint = MM_LONG;
+        if (op->type == ALLOC)
+            born[op->index] = op_index;
+        else if (op->type == FREE && op->index >= 0 && born[op->index] >= 0) {
+            if (op_index - born[op->index] < SHORT_LIFETIME)
+                trace->ops[born[op->index]].hint = MM_SHORT;
+            born[op->index] = -1;
+        }
+    }
+    free(born);
+}
 
-    return trace;
+/*
+ * cache_fresh - is the binary copy of a text trace file at least as
+ *               new as the text?
+ */
+static bool cache_fresh(const char *path, const char *cache)
+{
+    struct stat text, binary;
+
+    if (stat(path, &text) < 0 || stat(cache, &binary) < 0)
+        return false;
+    return binary.st_mtim.tv_sec > text.st_mtim.tv_sec ||
+        (binary.st_mtim.tv_sec == text.st_mtim.tv_sec &&
+         binary.st_mtim.tv_nsec >= text.st_mtim.tv_nsec);
+}
+
+/*
+ * write_trace - write a parsed trace as a binary trace file. It is only
+ *               a cache, so a failure just leaves it out. The file is
+ *               written under a temporary name and renamed, so that a
+ *               reader never maps half of it
+ */
+static void write_trace(const trace_t *trace, const char *cache)
+{
+    trace_header_t header;
+    char temp[MAXLINE + sizeof(TRACE_CACHE) + 16];
+    FILE *file;
+    bool ok;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.op_bytes = sizeof(traceop_t);
+    header.version = TRACE_VERSION;
+    header.lifetime = SHORT_LIFETIME;
+    header.weight = trace->weight;
+    header.num_ids = trace->num_ids;
+    header.num_ops = trace->num_ops;
+    header.data_bytes = trace->data_bytes;
+
+    sprintf(temp, "%s.%d", cache, (int)getpid());
+    if ((file = fopen(temp, "w")) == NULL)
+        return;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, file) ==
+        (size_t)trace->num_ops;
+    if (fclose(file) != 0 || !ok || rename(temp, cache) != 0)
+        unlink(temp);
 }
 
 /*
@@ -1008,11 +1728,15 @@ static void reinit_trace(trace_t *trace)
 
 /*
  * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(). The
+ *              requests of a binary trace file are unmapped instead
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the four arrays... */
+        munmap(trace->map, trace->map_bytes);
+    else
+        free(trace->ops);
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
@@ -1166,13 +1890,14 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   package on the trace. Note that mem_trim() can lower the brk
+ *   pointer, so heapsize is the high water mark of brk over the trace,
+ *   not its final value. The high water mark of brk is also saved in
+ *   KB in heap.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, double *heap)
 {
     int i;
     int index;
@@ -1183,6 +1908,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     size_t heap_size = 0;
     char *p;
     char *newp, *oldp;
+    struct mm_stats stats;
 
     reinit_trace(trace);
 
@@ -1190,6 +1916,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     mem_reset_brk();
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
+    if (stats_file != NULL)
+        mm_stats(&stats);
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -1198,7 +1926,13 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
 
-                if ((p = mm_malloc(size)) == NULL) {
+                if (compact_every)
+                    p = (char *) mm_halloc(size);
+                else if (use_hints)
+                    p = mm_malloc_hint(size, trace->ops[i].hint);
+                else
+                    p = mm_malloc(size);
+                if (p == NULL) {
                     app_error("trace %d: mm_malloc failed in eval_mm_util",
                               tracenum);
                 }
@@ -1216,7 +1950,10 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 oldsize = trace->block_sizes[index];
 
                 oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
+                newp = compact_every ?
+                    (char *) handle_realloc((void **) oldp, oldsize, newsize) :
+                    mm_realloc(oldp, newsize);
+                if (newp == NULL && newsize != 0) {
                     app_error("trace %d: mm_realloc failed in eval_mm_util",
                               tracenum);
                 }
@@ -1238,7 +1975,10 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                     p = trace->blocks[index];
                 }
 
-                mm_free(p);
+                if (compact_every)
+                    mm_hfree((void **) p);
+                else
+                    mm_free(p);
 
                 total_size -= size;
                 break;
@@ -1248,21 +1988,141 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                           tracenum);
         }
 
+        /* slide the payloads of the handles together now and then */
+        if (compact_every && (i + 1) % compact_every == 0)
+            mm_compact();
+
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
         heap_size = mem_heapsize();
+
+        /* keep the statistics of the largest heap */
+        if (stats_file != NULL && heap_size > max_heap_size)
+            mm_stats(&stats);
         max_heap_size = (heap_size > max_heap_size) ?
             heap_size : max_heap_size;
     }
 
+    if (stats_file != NULL) {
+        print_stats_csv(trace, "peak", &stats);
+        mm_stats(&stats);
+        print_stats_csv(trace, "end", &stats);
+    }
+
 #if !REF_ONLY
     printf(".");
 #endif
 
+    *heap = max_heap_size / 1024.0;
     return ((double)max_total_size / (double)max_heap_size);
 }
 
+/*
+ * handle_realloc - Resize the payload of a handle for eval_mm_util by
+ *   moving it to a new handle, as there is no realloc for handles
+ */
+static void **handle_realloc(void **handle, size_t oldsize, size_t size)
+{
+    void **newhandle;
+
+    if (size == 0) {
+        mm_hfree(handle);
+        return NULL;
+    }
+    if ((newhandle = mm_halloc(size)) == NULL)
+        return NULL;
+    if (handle != NULL) {
+        memcpy(*newhandle, *handle, oldsize < size ? oldsize : size);
+        mm_hfree(handle);
+    }
+    return newhandle;
+}
+
+/*
+ * print_stats_csv - Write the allocator statistics of a trace to the
+ *   CSV file, one metric per line. A slab class is named by the size
+ *   of its objects, and a free list by the smallest block it holds.
+ */
+static void print_stats_csv(const trace_t *trace, const char *phase,
+                            const struct mm_stats *stats)
+{
+    int i;
+    const char *name = trace->filename;
+
+#define CSV_ROW(metric, fmt, value) \
+    fprintf(stats_file, "%s,%s,%s,%" fmt "\n", name, phase, metric, value)
+#define CSV_CLASS(kind, size, metric, value) \
+    fprintf(stats_file, "%s,%s,%s_%s_%zu,%zu\n", name, phase, kind, metric, \
+            (size_t)(size), (size_t)(value))
+
+    CSV_ROW("heap_bytes", "zu", stats->heapBytes);
+    CSV_ROW("slab_bytes", "zu", stats->slabBytes);
+    CSV_ROW("list_bytes", "zu", stats->listBytes);
+    CSV_ROW("quick_bytes", "zu", stats->quickBytes);
+    CSV_ROW("largest_free", "zu", stats->largestFree);
+    CSV_ROW("fragmentation", ".4f", stats->fragmentation);
+    CSV_ROW("sbrk_calls", "zu", stats->sbrkCalls);
+    CSV_ROW("slab_hot", "#llx", stats->slabHot);
+
+    for (i = 0; i < MM_SLAB_CLASSES; i++) {
+        if (stats->slabAllocs[i] == 0)
+            continue;
+        CSV_CLASS("slab", 16*(i+1), "allocs", stats->slabAllocs[i]);
+        CSV_CLASS("slab", 16*(i+1), "frees", stats->slabFrees[i]);
+        CSV_CLASS("slab", 16*(i+1), "slabs", stats->slabCount[i]);
+        CSV_CLASS("slab", 16*(i+1), "used", stats->slabUsed[i]);
+    }
+    for (i = 0; i < MM_LIST_CLASSES; i++) {
+        size_t lo = (size_t)(4 + i%4) << (3 + i/4);
+        if (i == MM_LIST_CLASSES - 1)
+            lo = 4096;
+        if (stats->blockAllocs[i] == 0 && stats->freeBlocks[i] == 0)
+            continue;
+        CSV_CLASS("list", lo, "allocs", stats->blockAllocs[i]);
+        CSV_CLASS("list", lo, "frees", stats->blockFrees[i]);
+        CSV_CLASS("list", lo, "free_blocks", stats->freeBlocks[i]);
+        CSV_CLASS("list", lo, "free_bytes", stats->freeBytes[i]);
+    }
+
+#undef CSV_ROW
+#undef CSV_CLASS
+}
+
+/*
+ * reset_peak_rss - Start measuring the peak resident set of the
+ *   process again from its current resident set
+ */
+static void reset_peak_rss(void)
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+
+    if (fp != NULL) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+/*
+ * peak_rss - Return the peak resident set of the process in KB since
+ *   the last reset_peak_rss, or 0 if the system does not report it
+ */
+static double peak_rss(void)
+{
+    char line[MAXLINE];
+    double kb = 0;
+    FILE *fp = fopen("/proc/self/status", "r");
+
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, MAXLINE, fp) != NULL) {
+        if (sscanf(line, "VmHWM: %lf kB", &kb) == 1)
+            break;
+    }
+    fclose(fp);
+    return kb;
+}
+
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
@@ -1317,6 +2177,66 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_speed_batch - Like eval_mm_speed, but each run of up to
+ *    BATCH_MAX consecutive mallocs of the same size is one call to
+ *    mm_malloc_batch, and each run of consecutive frees is one call
+ *    to mm_free_batch.
+ */
+static void eval_mm_speed_batch(void *ptr)
+{
+    int i, j, k, index;
+    size_t size, newsize;
+    char *newp, *oldp;
+    void *batch[BATCH_MAX];
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    reinit_trace(trace);
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_speed_batch");
+
+    /* Interpret each trace request, or each run of requests */
+    for (i = 0;  i < trace->num_ops;  i = j)
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* mm_malloc_batch */
+                size = trace->ops[i].size;
+                for (j = i + 1; j < trace->num_ops && j - i < BATCH_MAX; j++)
+                    if (trace->ops[j].type != ALLOC || trace->ops[j].size != size)
+                        break;
+                if (mm_malloc_batch(size, j - i, batch) != (size_t)(j - i))
+                    app_error("mm_malloc_batch error in eval_mm_speed_batch");
+                for (k = i; k < j; k++)
+                    trace->blocks[trace->ops[k].index] = batch[k - i];
+                break;
+
+            case REALLOC: /* mm_realloc */
+                index = trace->ops[i].index;
+                newsize = trace->ops[i].size;
+                oldp = trace->blocks[index];
+                if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+                    app_error("mm_realloc error in eval_mm_speed_batch");
+                trace->blocks[index] = newp;
+                j = i + 1;
+                break;
+
+            case FREE: /* mm_free_batch */
+                for (j = i; j < trace->num_ops && j - i < BATCH_MAX; j++) {
+                    if (trace->ops[j].type != FREE)
+                        break;
+                    index = trace->ops[j].index;
+                    batch[j - i] = (index < 0) ? NULL : trace->blocks[index];
+                }
+                mm_free_batch(batch, j - i);
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_speed_batch");
+        }
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1433,6 +2353,7 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     double sumsecs = 0;
     double sumops  = 0;
     double sumutil = 0;
+    double maxrss = 0;
     int sum_perf_weight = 0;
     int sum_util_weight = 0;
 
@@ -1441,10 +2362,10 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 
     /* Print the individual results for each trace */
     if (tab_mode) {
-        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace\n");
+        printf("valid\tthru?\tutil?\tutil\trssKB\tops\tmsecs\tKops\ttrace\n");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n",
-               "valid", "util", "ops", "msecs", "Kops", "trace");
+        printf("  %5s  %6s %8s %7s%8s%8s  %s\n",
+               "valid", "util", "rssKB", "ops", "msecs", "Kops", "trace");
     }
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
@@ -1492,6 +2413,17 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                     printf(" %8s", "--");
             }
 
+            /* Peak resident set */
+            if (tab_mode) {
+                printf("%.0f\t", stats[i].rss);
+            } else {
+                /* print '--' if it was not measured */
+                if (stats[i].rss > 0)
+                    printf(" %8.0f", stats[i].rss);
+                else
+                    printf(" %8s", "--");
+            }
+
             /* Ops + Time */
             double msecs = stats[i].secs * 1000.0;
             double kops = (stats[i].ops*1e-3)/stats[i].secs;
@@ -1520,18 +2452,20 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                 sum_util_weight += 1;
                 sumutil += stats[i].util;
             }
+            maxrss = (stats[i].rss > maxrss) ? stats[i].rss : maxrss;
         }
         else {
             if (tab_mode) {
-                printf("no\t\t\t\t\t\t\t%s\n", stats[i].filename);
+                printf("no\t\t\t\t\t\t\t\t%s\n", stats[i].filename);
             } else {
-                printf("%2s%4s%7s%10s%7s%10s %s\n",
+                printf("%2s%4s%7s%9s%10s%7s%10s %s\n",
                        stats[i].weight != 0 ? "*" : "",
                        "no",
                        "-",
                        "-",
                        "-",
                        "-",
+                       "-",
                        stats[i].filename);
             }
         }
@@ -1547,16 +2481,18 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         double util = (sumutil/(double)sum_util_weight)*100.0;
         double tput = (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs;
         if (tab_mode) {
-            // "valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace"
-            printf("Sum\t%d\t%d\t%.1f\t%.0f\t\%.2f\n",
+            // "valid\tthru?\tutil?\tutil\trssKB\tops\tmsecs\tKops\ttrace"
+            printf("Sum\t%d\t%d\t%.1f\t\t%.0f\t\%.2f\n",
                    sum_perf_weight, sum_util_weight, sumutil*100.0, sumops, sumsecs * 1000.0);
-            printf("Avg\t\t\t%.1f\t\t\t%.0f\n",
+            printf("Avg\t\t\t%.1f\t\t\t\t%.0f\n",
                    util, tput);
+            printf("Max\t\t\t\t%.0f\n", maxrss);
         } else {
-            printf("%2d %2d  %7.1f%%%8.0f%10.3f%7.0f\n",
+            printf("%2d %2d  %7.1f%% %8.0f%8.0f%10.3f%7.0f\n",
                    sum_util_weight,
                    sum_perf_weight,
                    util,
+                   maxrss,
                    sumops,
                    sumsecs * 1000.0,
                    tput);
@@ -1571,7 +2507,8 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
     else {
         if (!tab_mode) {
-            printf("     %8s%10s%7s\n",
+            printf("     %8s%9s%10s%7s\n",
+                   "-",
                    "-",
                    "-",
                    "-");
@@ -1797,7 +2734,7 @@ static double measure_ref_throughput() {
  */
 static void usage(char *prog)
 {
-    fprintf(stderr, "Usage: %s [-hlVdD] [-f <file>]\n", prog);
+    fprintf(stderr, "Usage: %s [-hlVdDbpPBLR] [-j <n>] [-f <file>]\n", prog);
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
@@ -1808,6 +2745,15 @@ static void usage(char *prog)
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-j <n>     Evaluate <n> traces at once, each in a worker process\n");
+    fprintf(stderr, "\t-p         Let the workers of -j run while another one times its trace\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
+    fprintf(stderr, "\t-b         Time runs of same-size mallocs and of frees as batches\n");
+    fprintf(stderr, "\t-P         Compare every placement policy on every trace\n");
+    fprintf(stderr, "\t-B         Compare the buddy backend with segregated fit on every trace\n");
+    fprintf(stderr, "\t-L         Compare the peak heap with and without short-lived blocks apart\n");
+    fprintf(stderr, "\t-R         Parse text traces every time, without the binary cache\n");
+    fprintf(stderr, "\t-H <n>     Measure utilization through handles, compacting every <n> requests\n");
+    fprintf(stderr, "\t-C <file>  Write allocator statistics per trace to <file> as CSV\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
 }
@@ -22,6 +22,8 @@
 static unsigned char *heap;                 /* Starting address of heap */
 static unsigned char *mem_brk;              /* Current position of break */
 static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
+static unsigned char *mem_clean;            /* Start of the memory that is still zero */
+static size_t mem_sbrks;                    /* Number of calls to mem_sbrk since the reset */
 
 /* 
  * mem_init - initialize the memory system model
@@ -39,6 +41,7 @@ void mem_init(){
     }
     heap = addr;
     mem_max_addr = addr + MAX_HEAP_SIZE;
+    mem_clean = addr;
     mem_reset_brk();
 }
 
@@ -57,12 +60,13 @@ void mem_deinit(void){
  */
 void mem_reset_brk(){
     mem_brk = heap;
+    mem_sbrks = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		this model, the heap is shrunk with mem_trim, not by a negative incr.
  */
 void *mem_sbrk(intptr_t incr) {
     unsigned char *old_brk = mem_brk;
@@ -77,7 +81,10 @@ void *mem_sbrk(intptr_t incr) {
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
     }
     if (ok) {
+	mem_sbrks++;
 	mem_brk += incr;
+	if (mem_brk > mem_clean)
+	    mem_clean = mem_brk;
 	return (void *) old_brk;
     } else {
 	errno = ENOMEM;
@@ -85,6 +92,44 @@ void *mem_sbrk(intptr_t incr) {
     }
 }
 
+/*
+ * mem_trim - shrink the heap by decr bytes and give the whole pages
+ *		past the new break back to the system. Returns the new break.
+ */
+void *mem_trim(size_t decr) {
+    if (decr > (size_t)(mem_brk - heap)) {
+	fprintf(stderr, "ERROR: mem_trim failed.  Attempt to shrink heap of %zd bytes by %zd\n",
+		(size_t)(mem_brk - heap), decr);
+	errno = EINVAL;
+	return (void *) -1;
+    }
+    /* Give back the whole pages past the new break, up to the end of the
+       page of the highest break since the memory was last clean, which
+       may be past the old break after mem_reset_brk */
+    uintptr_t page = (uintptr_t) mem_pagesize();
+    uintptr_t old_end = ((uintptr_t) mem_clean + page - 1) & ~(page - 1);
+    mem_brk -= decr;
+    mem_release(mem_brk, old_end - (uintptr_t) mem_brk);
+
+    /* Only the whole pages past the break are zero again */
+    unsigned char *zero = (unsigned char *)(((uintptr_t) mem_brk + page - 1) & ~(page - 1));
+    if (mem_clean > zero)
+	mem_clean = zero;
+    return (void *) mem_brk;
+}
+
+/*
+ * mem_release - give the whole pages inside [addr, addr+len) back to
+ *		the system. They stay mapped and read as zero when touched again.
+ */
+void mem_release(void *addr, size_t len) {
+    uintptr_t page = (uintptr_t) mem_pagesize();
+    uintptr_t lo = ((uintptr_t) addr + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t) addr + len) & ~(page - 1);
+    if (lo < hi)
+	madvise((void *) lo, hi - lo, MADV_DONTNEED);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -99,6 +144,15 @@ void *mem_heap_hi(){
     return (void *)(mem_brk - 1);
 }
 
+/*
+ * mem_heap_clean - return the address past which the memory has not
+ *		been handed out since it was mapped or given back, so it is zero.
+ *		mem_reset_brk does not lower it.
+ */
+void *mem_heap_clean(){
+    return (void *) mem_clean;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -106,6 +160,14 @@ size_t mem_heapsize() {
     return (size_t)(mem_brk - heap);
 }
 
+/*
+ * mem_sbrk_count() - returns the number of calls to mem_sbrk that
+ *		grew the heap since it was last reset
+ */
+size_t mem_sbrk_count() {
+    return mem_sbrks;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
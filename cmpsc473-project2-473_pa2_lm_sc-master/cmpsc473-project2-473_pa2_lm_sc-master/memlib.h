@@ -5,10 +5,14 @@
 void mem_init();               
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
+void *mem_trim(size_t decr);
+void mem_release(void *addr, size_t len);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_heap_clean(void);
 size_t mem_heapsize(void);
+size_t mem_sbrk_count(void);
 size_t mem_pagesize(void);
 
 /* Functions used for memory emulation */
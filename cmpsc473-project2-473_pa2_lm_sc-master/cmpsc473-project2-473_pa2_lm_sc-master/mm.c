@@ -3,26 +3,125 @@
  *
  * Description: We use segregate free lists and slab allocation with bitmaps to complete each memory allocation task. 
  * 
- * For malloc(), if the required size is less than or equal to 32, we will mainly allocate the payload in slabs. We 
- * have two types of slabs: one for payload of size 16, and one for payload of size 32. At the beginning of each 
- * slab, there is a bitmap indicating which locations are free. In this way, the payloads in slabs do not need header
- * and footer, and this help us decrease internal fragmentation. If the required size in malloc() is greater than 32,
- * we will allocate the payload using the segregate free lists. We have 36 free lists which are for free blocks of 
- * sizes within 2^5, 2^6, 2^7, ... , 2^40 respectively. According to the required payload size, we will search through
- * the corresponding free list and find a best fit for the payload. Each block in the free lists will have its first
- * 24 bytes as the following: 8 bytes for header, 8 bytes for the address of the predecessor, 8 bytes for address of
- * the successor, and it will also have its last 8 bytes for a footer. After the block is allocated, the information
- * about predecessor and successor will be eliminated. If we fail to allocate the payload because there is not enough
- * space in the heap, we will increase the size of the heap and then allocate the payload. 
+ * For malloc(), if the required size is less than or equal to 512, we will mainly allocate the payload in slabs. We
+ * have 32 slab classes, one for every multiple of 16 bytes up to 512. Every slab is a block of 4096 bytes that holds
+ * objects of one class and fills exactly one aligned page of the heap, and at the beginning of each slab, there is a
+ * bitmap indicating which locations are free.
+ * The slabs of a class that still have a free location are kept in a partial slab list, so we never look at a full
+ * slab, and we find the free location in the bitmap with count-trailing-zeros. In this way, the payloads in slabs do
+ * not need header and footer, and this help us decrease internal fragmentation. The slabs of a class sit in the slots
+ * of its directory, a chain of nodes that grows by SLABS_PER_NODE slots whenever every slot is taken, so a class
+ * never runs out of slabs; the empty slots form a stack, and the first node counts the slabs of the class and the
+ * objects allocated in them. A slab that is barely used costs a whole page, so malloc() counts the requests of each
+ * class, and only the busiest slabHotMax classes (SLAB_HOT unless mm_set_slab_classes() says otherwise) make new
+ * slabs: a class becomes hot once it has SLAB_PROMOTE requests, and every SLAB_WINDOW requests the classes are
+ * ranked again, which demotes the idle ones. A cold class still fills the slabs it has, and its other payloads
+ * are blocks. If the required size in malloc() is greater than 512, or its class is cold, we will allocate the payload
+ * using the segregate free lists. We have 28 free lists: each power of two from 2^5 to 2^11 is split into 4 size
+ * classes, and a bitmap records which lists are not empty. Free blocks of 4096 bytes or more are kept in one more
+ * class, a treap ordered by size and then address, where the children take the places of the predecessor and the
+ * successor, and the priority is a hash of the address. According to the required payload size, we will search the list
+ * of its own class for a best fit, and if there is none, we will use the bitmap to jump straight to the first non-empty
+ * class above it, where every block fits. Under best fit and good fit, before a larger class, we will take the
+ * designated victim, the rest of the last split if it was below 4096 bytes, so that a run of requests is carved from
+ * one block. In the treap, the best fit is found in one walk down from the root. mm_set_policy() picks another
+ * placement in the lists for the next mm_init(): first fit, next fit from a rover that moves on when its block leaves
+ * the list, first fit in lists that are kept ordered by address, or good fit, the best of the first GOOD_DEPTH blocks
+ * that fit. Each block in the free lists will have its first 24 bytes as the following: 8 bytes for header, 8 bytes for
+ * the address of the predecessor, 8 bytes for address of the successor, and it will also have its last 8 bytes for a
+ * footer. After the block is allocated, the information about predecessor and successor becomes part of the payload,
+ * and so does the footer: an allocated block only has a header, and the header of every block has a bit telling whether
+ * the block in front of it is allocated, so we only look for a footer in front of a block when that block is free. If
+ * we fail to allocate the payload because there is not enough space in the heap, we will increase the size of the heap
+ * and then allocate the payload. The free block at the end of the heap, if there is one, is extended instead of left
+ * behind, the heap grows by at least HEAP_CHUNK bytes at a time, and whatever the payload does not use goes back to the
+ * free lists.
  *
- * For free(), we will first check if the given payload is allocated in slabs. If it does, we will change the bitmap
- * of the corresponding slab to mark the payload location as free. If the given payload is not allocated in slabs, we
- * will add it into a free list according to its size.
+ * For free(), we will first check if the given payload is allocated in slabs, by looking up its page in a bitmap of
+ * the pages that hold slabs. If it does, the slab starts at the beginning of the page, and we will change the bitmap
+ * of the corresponding slab to mark the payload location as free, and give the slab back to the free lists once it
+ * is empty. If the given payload is not allocated in slabs, we will add it into a free list according to its size.
+ * When the coalesced block is the free tail of the heap and reaches trimThreshold, it waits as trimTail: only once
+ * a later block request has been served without it do we shrink the heap with mem_trim() and keep TRIM_KEEP bytes
+ * of it, so a tail that the next request takes back is never trimmed at all; if the heap has to grow again after a
+ * trim, the threshold doubles, up to TRIM_MAX. Every free block of EXTENT_MIN bytes or more is also an extent in a
+ * second treap, ordered by address, whose links follow the links of the first one, and whose nodes know the largest
+ * size in their subtree. So the lowest extent that fits is found in one walk down, which address-ordered first fit
+ * takes for a block of EXTENT_MIN or more instead of the best fit. Once purgeThreshold bytes have been freed into the
+ * extents, the next block request walks the treap up the heap and gives the whole pages inside each extent that was
+ * there at the last walk back to the system with mem_release(), but keeps its tags; the free tail is left to
+ * trimming. The rest of such an extent split by malloc() stays given back. After each walk the threshold doubles
+ * from RELEASE_MIN up to TRIM_MAX, and is never less than the bytes freed since the last walk, so a heap that keeps
+ * taking its extents back is not walked over and over, however large its blocks.
+ * A freed block of at most QUICK_BYTES is not coalesced right away: it stays marked allocated in the quick list
+ * of its exact size, and the next malloc() of that size takes the last one back without a search or a split. A
+ * quick list is coalesced into the free lists when it holds QUICK_BOUND blocks, and all of them are before no
+ * free block fits and the heap would grow.
  *
- * For realloc(), we will check if the old size is equal to the new size. If it does, we will do nothing and just 
- * return the old pointer. If the old size is greater than the new size, we will free the redundant space at the end 
- * using the free() function. If the old size is smaller than the new size, we will copy the content of the payload,
- * free the old pointer, allocate a new payload of the new size, and paste the content to the new payload.
+ * For realloc(), we resize the block in place whenever we can, so the payload is not copied. If the old size is
+ * greater than or equal to the new size, we will free the redundant space at the end using the free() function. If
+ * the old size is smaller, we will absorb the next block when it is free and big enough, or extend the heap when the
+ * block is the last one. Only otherwise we allocate a new payload, copy the content once, and free the old pointer.
+ * A block that realloc() has grown is marked with a bit in its header; it gets a quarter of its size as headroom
+ * when it moves again, and it keeps that headroom when it shrinks a little.
+ *
+ * For calloc(), we only clear the memory that has been used before. The memory from zeroFrom to the end of the
+ * heap is known to be zero, except the tags of the free tail of the heap, its header, links and footer: every block
+ * that is carved from the tail moves zeroFrom past itself, and the tags the tail leaves behind when it grows or
+ * takes in a freed block are cleared or moved under zeroFrom. So a payload carved from fresh memory only needs its
+ * first words and its last word cleared, and a large one from a fresh heap leaves its pages untouched.
+ *
+ * For memalign(), posix_memalign() and aligned_alloc(), an alignment up to 16 is what malloc() gives anyway. A
+ * larger one is served by the same search that places the slabs on their pages: we take the first free block with
+ * room for an aligned block after a gap of at least 32 bytes, and give the gap back to the free lists.
+ * malloc_usable_size() returns the whole object of a slab, or the whole block without its header.
+ *
+ * mm_malloc_batch() allocates many payloads of one size at once: in the slabs, it takes all the free objects of a
+ * word of a bitmap with one store, and otherwise it carves all the blocks one after another from one free block
+ * that fits them together. mm_free_batch() frees many payloads, and the ones next to each other that share a slab
+ * update its counter and its partial list only once.
+ *
+ * mm_set_backend() (or building with -DBUDDY) replaces the blocks of the free lists by binary buddy blocks for the
+ * next mm_init(), and the slabs take their pages from the buddies. A buddy block is a power of two of at least
+ * 2^BUDDY_MIN bytes at an offset that is a multiple of its size, with a header and no footer, so its buddy is found
+ * by flipping one bit of the offset. The free blocks of each order are in a list, a bitmap of orders finds the
+ * smallest free one that is large enough, which is split in halves down to the order, and a freed block merges with
+ * its buddy one order at a time while the buddy is free. Whether the buddy is free is first looked up in a bitmap
+ * with one bit for every 2^BUDDY_MIN bytes, so an allocated buddy is not touched. The heap grows by the free blocks
+ * that align the new block, and the payload of every block of a page or more starts a page, so memalign() only asks
+ * for a block as large as the alignment.
+ *
+ * mm_halloc() allocates a relocatable payload and returns a handle, a slot of the handle table whose word is the
+ * address of the payload. The table is a chain of nodes of HANDLES_PER_NODE slots, and its empty slots form a
+ * stack. The block of the payload starts with a head that points back to the slot and counts the locks of
+ * mm_hlock(). mm_compact() coalesces the quick lists, marks the blocks of the unlocked handles with the realloc bit,
+ * which it takes off every other block, and walks the heap once: the marked blocks that follow a free block slide
+ * down over it one after another, and their slots follow them, so the free block travels up until it meets the next
+ * free block or a block that cannot move. Then the free tail is trimmed down to TRIM_KEEP bytes.
+ *
+ * mm_set_lifetimes() keeps the payloads that are expected to be freed soon apart from the others, from the next
+ * mm_init(). A short-lived payload of a slab class goes to slabs of its own, in a second directory of the class, and a
+ * short-lived block is carved from the back of its free block, so the front stays free for the long-lived ones and
+ * takes the block back once it is freed; the free tail of the heap still gives its front. mm_malloc_hint() tells the
+ * lifetime, MM_SHORT or MM_LONG, and otherwise malloc() guesses it from samples: every LIFETIME_PERIOD-th payload is
+ * kept in the slot of its address in a small table, and its size votes short when it is freed within LIFETIME_SHORT
+ * malloc() calls, and long when it is freed later or is still there when another sample takes its slot. A size is
+ * short-lived while its votes are positive. It is off by default, since on the traces the second slabs of a class
+ * cost more pages than the holes they keep away from the long-lived payloads.
+ *
+ * mm_stats() reports counters that are kept up to date as the heap changes: the lists count their blocks and bytes
+ * as blocks come and go, the first node of a slab directory counts the objects of its class, and the user's blocks
+ * are counted by the class of their size as they are allocated and freed. Only the largest free block is looked for
+ * when the counters are read, in the last non-empty class.
+ *
+ * Outside the driver (make libmm.so), the file also builds a thread-safe allocator that can be preloaded into
+ * pthread programs. The blocks are shared by every thread under one heap lock, but the slabs are split among
+ * NUM_ARENAS arenas, each with its own slab directories and lock, and every thread is bound to an arena the first
+ * time it allocates. Small payloads are cached per thread, so most malloc() and free() calls take no lock at all,
+ * and the caches fill from every slab class, hot or not, since they serve most requests without counting them.
+ * A payload freed by a thread of another arena is pushed onto a lock-free stack that the owner drains when it fills
+ * a cache, when a thread binds to it or exits, and, once no thread is bound to it, right away by the thread that
+ * frees.
  *
  * Author     : Leran Ma, Sishi Cheng
  *
@@ -34,7 +133,7 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <math.h>
+#include <errno.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -67,948 +166,4936 @@
 #define memcpy mem_memcpy
 #endif /* DRIVER */
 
+#ifdef DRIVER
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define memalign mm_memalign
+#define malloc_usable_size mm_malloc_usable_size
+#define MM_LOCAL
+#else
+/* the functions below serve one arena; the exported ones at the end of the file bind threads to arenas */
+#include <pthread.h>
+#include <sys/mman.h>
+#include "config.h"
+#define malloc arena_malloc
+#define free arena_free
+#define realloc arena_realloc
+#define calloc arena_calloc
+#define posix_memalign arena_posix_memalign
+#define aligned_alloc arena_aligned_alloc
+#define memalign arena_memalign
+#define malloc_usable_size arena_malloc_usable_size
+#define mm_malloc_batch arena_malloc_batch
+#define mm_free_batch arena_free_batch
+#define mm_halloc arena_halloc
+#define mm_hlock arena_hlock
+#define mm_hunlock arena_hunlock
+#define mm_hfree arena_hfree
+#define mm_compact arena_compact
+#define mm_malloc_hint arena_malloc_hint
+#define MM_LOCAL __thread __attribute__(( tls_model( "initial-exec" ) ))
+#endif /* DRIVER */
+
 /* What is the correct alignment? */
 #define ALIGNMENT 16
 
+#define CLASS_BITS 2                    // log2 of the number of size classes per power of two
+#define CLASSES_PER_POW (1 << CLASS_BITS) // The number of size classes per power of two
+#define TREE_EXP 12                     // log2 of the smallest free block kept in the tree
+#define TREE_CLASS ((TREE_EXP - 5)*CLASSES_PER_POW) // The class of the tree of large free blocks
+#define NUM_CLASSES (TREE_CLASS + 1)    // The number of segregate free lists (2^5 ... 2^12) and the tree
+#define MAP_WORDS ((NUM_CLASSES + 63)/64) // The number of words in the non-empty class bitmap
+
+#define HEAP_CHUNK 2048       // The smallest growth of the heap, in bytes
+#define PREV_ALLOC 2          // The bit in the header of a block whose previous block is allocated
+#define REALLOC_BIT 4         // The bit in the header of a block that realloc() has grown
+
+#define QUICK_BYTES 1024      // The largest block that is kept in a quick list when it is freed
+#define QUICK_CLASSES (QUICK_BYTES/ALIGNMENT) // The number of quick lists, one for each block size from 16
+#define QUICK_BOUND 16        // The largest number of blocks in a quick list
+
+#define TRIM_MIN (128*1024)   // The first threshold of the free tail of the heap that is trimmed
+#define TRIM_MAX (32*1024*1024) // The largest the trim threshold grows to
+#define TRIM_KEEP HEAP_CHUNK  // The size of the free tail that is kept after a trim
+#define RELEASE_MIN (256*1024) // The bytes freed into extents, or the smallest merged buddy, whose pages are given back
+#define GOOD_DEPTH 8          // The number of fitting blocks of a list that good fit compares
+
+#define BUDDY_MIN 5           // log2 of the smallest buddy block, and of the unit of the bitmap of free buddies
+#define BUDDY_ORDERS 41       // The number of orders of buddy blocks, up to the largest heap
+#define BUDDY_PAGE 12         // log2 of the alignment of the payloads of the largest buddy blocks
+#define BUDDY_MAP_MAX 28      // log2 of the most of the heap that the bitmap of free buddies covers
+
+#define EXTENT_MIN (64*1024) // The smallest free block that is an extent, in the tree ordered by address
+#define EXTENT_LEFT 3         // The word of the left child of an extent in the tree of extents
+#define EXTENT_RIGHT 4        // The word of the right child
+#define EXTENT_MAX 5          // The word of the largest size in the subtree of the extent
+#define EXTENT_AGE 6          // The word of the number of times the tree was purged since the extent was added
+#define EXTENT_WORDS 7        // The number of words of the tags at the beginning of an extent
+
+#define SLAB_MAX 512          // The largest payload that is allocated in slabs
+#define SLAB_CLASSES (SLAB_MAX/ALIGNMENT) // The number of slab classes (16, 32, ..., 512)
+#define SLAB_DIRS (2*SLAB_CLASSES) // The number of slab directories, of the long-lived and short-lived objects
+#define SLAB_BYTES 4096       // The size of the block of a slab, with its header and footer
+#define SLAB_HOT 8            // The default number of slab classes that new objects go to
+#define SLAB_WINDOW 1024      // The number of small requests between two rankings of the slab classes
+#define SLAB_PROMOTE 16       // The requests of a class since the last ranking that make it hot right away
+#define SLAB_DEMOTE 4         // The fewest requests of a class since the last ranking that keep it hot
+
+#define SLAB_NEXT 0           // The word of the next partial slab in the head of a slab
+#define SLAB_PREV 1           // The word of the previous partial slab
+#define SLAB_INFO 2           // The word of the class, the lifetime, the number of objects and the arena
+#define SLAB_USED 3           // The word of the number of allocated objects
+#define SLAB_SLOT 4           // The word of the address of the directory slot of the slab
+#define SLAB_MAP 5            // The first word of the occupancy bitmap
+#define SLAB_SHORT 8          // The bit of the information word of a slab of short-lived objects
+
+#define DIR_PARTIAL 0         // The word of the first partial slab in the first node of a slab directory
+#define DIR_EMPTY 1           // The word of the first empty slot of the directory
+#define DIR_SLABS 2           // The word of the number of slabs of the class
+#define DIR_USED 3            // The word of the number of allocated objects in the slabs of the class
+#define DIR_ALLOCS 4          // The word of the number of objects ever allocated in the slabs of the class
+#define DIR_NEXT 5            // The word of the next node of the directory, in every node
+#define DIR_SLOTS 6           // The first slot of a node
+#define SLABS_PER_NODE 32     // The number of slots in a node of a directory
+#define DIR_WORDS (DIR_SLOTS + SLABS_PER_NODE) // The number of words in a node
+
+#define LIFETIME_SAMPLES 64   // The slots of the table of sampled payloads, whose lifetimes are measured
+#define LIFETIME_PERIOD 16    // The number of malloc() calls from one sampled payload to the next
+#define LIFETIME_SHORT 1024   // The most malloc() calls before its free() that make a payload short-lived
+#define LIFETIME_VOTES 4      // The largest weight of the votes of the lifetimes sampled for a size
+
+#define HANDLE_SLOT 0         // The word of the address of the slot of the handle, in the head of a relocatable payload
+#define HANDLE_LOCKS 1        // The word of the number of locks on the payload
+#define HANDLE_HEAD ALIGNMENT // The size of the head in front of a relocatable payload
+#define HANDLE_NEXT 0         // The word of the next node of the handle table
+#define HANDLES_PER_NODE 63   // The number of slots in a node of the handle table
+#define HANDLE_WORDS (HANDLES_PER_NODE + 1) // The number of words in a node
+
+_Static_assert( MM_SLAB_CLASSES == SLAB_CLASSES, "mm.h counts the slab classes" );
+_Static_assert( MM_LIST_CLASSES == NUM_CLASSES, "mm.h counts the free lists" );
+
 // Functions
 static bool in_heap( const void *p );
-void free( void *ptr );
-static void addTags( char *block,
-                     uint8_t valid,
-                     size_t fullSize,
-                     char *pred,
-                     char *succ );
+static void *blockAdd( size_t size );
+static void *blockPlace( size_t size, bool shortLived );
+static char *victimFit( size_t newsize, size_t *fullSize );
+static void blockDelete( void *ptr );
+static void *blockAlign( size_t size, size_t alignment );
+static unsigned buddyOrder( size_t size );
+static void *buddyAdd( size_t size );
+static void *buddyAlign( size_t size, size_t alignment );
+static void buddyDelete( void *ptr );
 
 char **lists; // The segregate free lists
-char **slabs16; // The slab for the 16-bytes's block
-char **slabs32; // The slab for the 32-bytes's block
+uint64_t *nonEmpty; // The bitmap of the segregate free lists that are not empty
+uint64_t *listCounts; // The number of blocks in each segregate free list
+uint64_t *listBytes; // The number of bytes in each segregate free list
+uint64_t *blockAllocs; // The number of blocks allocated for the user, by the class of their size
+uint64_t *blockFrees; // The number of blocks the user freed, by the class of their size
+int backend; // The backend of the payloads that are not in slabs
+#ifdef BUDDY
+int backendNext = MM_BUDDY; // The backend that mm_init() takes, kept across mm_init()
+#else
+int backendNext = MM_SEGREGATED; // The backend that mm_init() takes, kept across mm_init()
+#endif
+char *buddyBase; // The start of the buddy blocks, a header in front of a page
+char **buddyLists; // The free buddy blocks of each order
+uint64_t buddyOrders; // The bitmap of the orders with a free buddy block
+uint64_t *buddyMap; // The bitmap of the units of the buddy blocks where a free block starts
+size_t buddyMapWords; // The number of words in the bitmap of free buddies
+int policy; // The placement policy of the free lists
+int policyNext = MM_BEST_FIT; // The placement policy that mm_init() takes, kept across mm_init()
+bool lifetimes; // Whether the payloads expected to be freed soon are kept apart from the others
+bool lifetimesNext = false; // Whether mm_init() segregates the lifetimes, kept across mm_init()
+int8_t *lifetimeVotes; // The votes of the sampled lifetimes of each size, short when positive
+uint64_t *lifetimeSamples; // The sampled payloads, and their births and sizes, two words for each slot
+size_t lifetimeClock; // The number of malloc() calls since mm_init(), while the lifetimes are segregated
+char *victim; // The designated victim, the rest of the last split, which the next small request takes first
+char *rover; // The free block that next fit looks at first, in the list of roverClass
+uint8_t roverClass; // The class of the rover
+char *extents; // The tree of the extents, the free blocks of at least EXTENT_MIN bytes, ordered by address
+size_t extentDirty; // The bytes freed into extents since the tree was last purged
+size_t purgeThreshold; // The bytes freed into extents at which the tree is purged
+char *firstBlock; // The first block after the tables at the beginning of the heap
+char **quickLists; // The quick lists of freed blocks that are not coalesced yet, linked through their payloads
+uint64_t *quickCounts; // The number of blocks in each quick list
+size_t quickTotal; // The number of blocks in all the quick lists
+MM_LOCAL uint64_t **slabDirs; // The slab directories of the arena, one chain of nodes of slots for each class,
+                              // and one more for each class of short-lived objects
+int slabDirCount; // The number of slab directories, SLAB_DIRS while the lifetimes are segregated
+MM_LOCAL unsigned arenaId; // The arena of the thread, which owns the slabs it makes
+uint32_t *slabHits; // The small requests of each slab class, halved at every ranking
+uint64_t slabHot; // The bitmap of the hot slab classes, whose new objects go to slabs
+unsigned slabHotCount; // The number of hot slab classes
+unsigned slabHotMax = SLAB_HOT; // The largest number of hot slab classes, kept across mm_init()
+size_t slabWindow; // The number of small requests left until the next ranking
+uint64_t *slabPages; // The bitmap of the heap pages that hold a slab
+size_t slabPageWords; // The number of words in the bitmap of slab pages
+uintptr_t heapPage; // The page of the start of the heap
+uint64_t *handleNodes; // The nodes of the handle table, chained through their first word
+uint64_t *handleEmpty; // The first empty slot of the handle table, in a stack tagged with the low bit
+bool lastAlloc; // Whether the last block of the heap is allocated
+size_t trimThreshold; // The size of the free tail of the heap at which the heap is trimmed
+bool trimmed; // Whether the heap has been trimmed since it last grew
+char *trimTail; // The large free tail of the heap, trimmed once a block request has passed it by
+char *zeroFrom; // The start of the memory known to be zero, except the tags of the free tail of the heap
+#ifndef DRIVER
+pthread_mutex_t heapMutex; // The lock of the blocks and the heap, shared by the arenas
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : listDelete
-// Description  : Delete the segregate free list
+// Function     : heapLock
+// Description  : Lock the blocks and the heap against the other arenas. There is
+//                only one arena in the driver, so there is nothing to lock
 //
-// Inputs       : pred - the predecessor of the list that needs to be deleted
-//                succ - the successor of the list that needs to be deleted
-//                index - the index of the list 
+// Inputs       : nothing
 // Outputs      : nothing
-static void listDelete( char *pred, char *succ, uint8_t index )
+static inline void heapLock( void )
 {
-    // Check whether the predecessor is NULL
-    if ( !pred )
-    {
-        lists[index] = succ;
-        addTags( succ, 2, 0, NULL, (char *)1 );
-    }
-    else
-    {
-        addTags( pred, 2, 0, (char *)1, succ );
-        addTags( succ, 2, 0, pred, (char *)1 );
-    }
-    return;
+#ifndef DRIVER
+    pthread_mutex_lock( &heapMutex );
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : listAdd
-// Description  : Add the segregate free list
+// Function     : heapUnlock
+// Description  : Unlock the blocks and the heap
 //
-// Inputs       : addr - the address of the block
-//                index - the index of the list 
+// Inputs       : nothing
 // Outputs      : nothing
-static void listAdd( char *addr, uint8_t index )
+static inline void heapUnlock( void )
 {
-    addTags( addr, 2, 0, (char *)1, lists[index] );
-    addTags( lists[index], 2, 0, addr, (char *)1 );
-    lists[index] = addr;
-    return;
+#ifndef DRIVER
+    pthread_mutex_unlock( &heapMutex );
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : getIndedx
-// Description  : Calculate the index of the block
+// Function     : getHeader
+// Description  : Read the header of a block
 //
-// Inputs       : size - the size of the block
-// Outputs      : The index of the block
-static uint8_t getIndex( size_t size )
+// Inputs       : block - the block
+// Outputs      : the header of the block
+static inline uint64_t getHeader( const char *block )
 {
-    return (uint8_t) ceil( log2(size) ) - 5;
+    return *(const uint64_t *)block;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : getBlockInfo
-// Description  : Get the information of the block
+// Function     : putHeader
+// Description  : Write the header of a block
 //
-// Inputs       : blockHead - the header of the block
-//                blockFoot - the footer of the block
-//                isValid - whether the block is free
-//                size - the size of the block
-//                pred - the predecessor of the block
-//                succ - the successor of the block
+// Inputs       : block - the block
+//                header - the header of the block
 // Outputs      : nothing
-static void getBlockInfo( char *blockHead,
-                          char *blockFoot,
-                          uint8_t *isValid,
-                          size_t *size,
-                          char **pred,
-                          char **succ )
+static inline void putHeader( char *block, uint64_t header )
 {
-    uint64_t header;
-    char *pred_tmp = NULL; // The temporary pointer for predecessor
-    char *succ_tmp = NULL; // The temporary pointer for successor
-
-    // Check the blockHead is not null
-    if ( blockHead )
-    {
-        mem_memcpy( &header, blockHead, sizeof(header) );
-
-        // Check the block is free 
-        if ( isValid )
-            *isValid = header & 7;
-
-        // Check the size is not null
-        if ( size )
-            *size = header >> 3;
+    *(uint64_t *)block = header;
+}
 
-        // Check the block is not free and the size is greater than ALIGNMENT
-        if ( !(header & 7) && (header >> 3) > ALIGNMENT )
-        {
-            // Check the predecessor is not null
-            if ( pred )
-            {
-                mem_memcpy( &pred_tmp, blockHead + ALIGNMENT/2, sizeof( pred_tmp ) );
-                *pred = pred_tmp;
-            }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getFooter
+// Description  : Read the footer of the free block in front of a block
+//
+// Inputs       : block - the block after the free block
+// Outputs      : the footer of the free block
+static inline uint64_t getFooter( const char *block )
+{
+    return *(const uint64_t *)( block - ALIGNMENT/2 );
+}
 
-            // Check the successor is not null
-            if ( succ )
-            {
-                mem_memcpy( &succ_tmp, blockHead + ALIGNMENT, sizeof( succ_tmp ) );
-                *succ = succ_tmp;
-            }
-        }
-    }
-    else if ( blockFoot )
-    {
-        mem_memcpy( &header, blockFoot - sizeof(header), sizeof(header) );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : putFooter
+// Description  : Write the footer of a free block, a copy of its header
+//
+// Inputs       : block - the free block
+//                header - the header of the block
+// Outputs      : nothing
+static inline void putFooter( char *block, uint64_t header )
+{
+    *(uint64_t *)( block + (header >> 3) - ALIGNMENT/2 ) = header;
+}
 
-        // Check the block is free
-        if ( isValid )
-            *isValid = header & 7;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getPred
+// Description  : Read the predecessor of a free block in its list
+//
+// Inputs       : block - the free block
+// Outputs      : the predecessor
+static inline char *getPred( const char *block )
+{
+    return *(char *const *)( block + ALIGNMENT/2 );
+}
 
-        // Check the size of the block is not null
-        if ( size )
-            *size = header >> 3;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getSucc
+// Description  : Read the successor of a free block in its list
+//
+// Inputs       : block - the free block
+// Outputs      : the successor
+static inline char *getSucc( const char *block )
+{
+    return *(char *const *)( block + ALIGNMENT );
+}
 
-        // Check the block is not free and the size is greater than ALIGNMENT
-        if ( !(header & 7) && (header >> 3) > ALIGNMENT )
-        {
-            // Check the predecessor is not null
-            if ( pred )
-            {
-                mem_memcpy( &pred_tmp, blockFoot - (header >> 3) + ALIGNMENT/2, sizeof( pred_tmp ) );
-                *pred = pred_tmp;
-            }
-            // Check the successor is not null
-            if ( succ )
-            {
-                mem_memcpy( &succ_tmp, blockFoot - (header >> 3) + ALIGNMENT, sizeof( succ_tmp ) );
-                *succ = succ_tmp;
-            }
-        }
-    }
-    return;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setPred
+// Description  : Write the predecessor of a free block in its list
+//
+// Inputs       : block - the free block
+//                pred - the predecessor
+// Outputs      : nothing
+static inline void setPred( char *block, char *pred )
+{
+    *(char **)( block + ALIGNMENT/2 ) = pred;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : addTags
-// Description  : Add the tags for the block
+// Function     : setSucc
+// Description  : Write the successor of a free block in its list
 //
-// Inputs       : block - the block
-//                valid - the status of whether the block is valid
-//                fullsize - the size of the block
-//                pred - the predecessor of the block
-//                succ - the successor of the block
+// Inputs       : block - the free block
+//                succ - the successor
 // Outputs      : nothing
-static void addTags( char *block,
-                     uint8_t valid,
-                     size_t fullSize,
-                     char *pred,
-                     char *succ )
+static inline void setSucc( char *block, char *succ )
 {
-    // Check the block is not null
-    if ( !block )
-        return;
+    *(char **)( block + ALIGNMENT ) = succ;
+}
 
-    uint64_t header = fullSize << 3; // The header of the block
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : treeLeft
+// Description  : Get the link to the left child of a block in the tree. The
+//                children take the places of the predecessor and the successor
+//
+// Inputs       : block - the free block
+// Outputs      : the link to the left child
+static inline char **treeLeft( char *block )
+{
+    return (char **)( block + ALIGNMENT/2 );
+}
 
-    // Check the block is not free
-    if ( valid == 1 )
-    {
-        header++;
-        pred = NULL;
-        succ = NULL;
-        mem_memcpy( block, &header, sizeof(header) );
-        mem_memcpy( block + fullSize - ALIGNMENT/2, &header, sizeof(header) );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : treeRight
+// Description  : Get the link to the right child of a block in the tree
+//
+// Inputs       : block - the free block
+// Outputs      : the link to the right child
+static inline char **treeRight( char *block )
+{
+    return (char **)( block + ALIGNMENT );
+}
 
-        // Check the block size is greater than 16
-        if ( fullSize > ALIGNMENT )
-        {
-            mem_memcpy( block + ALIGNMENT/2, &pred, sizeof(pred) );
-            mem_memcpy( block + ALIGNMENT, &succ, sizeof(succ) );
-        }
-    }
-    else if ( valid == 0 )
-    {
-        mem_memcpy( block, &header, sizeof(header) );       
-        mem_memcpy( block + fullSize - ALIGNMENT/2, &header, sizeof(header) );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : treeLess
+// Description  : Compare two blocks in the tree, by size and then by address
+//
+// Inputs       : a - the first block
+//                b - the second block
+// Outputs      : whether a comes before b
+static inline bool treeLess( char *a, char *b )
+{
+    size_t sizeA = getHeader( a ) >> 3; // The size of the first block
+    size_t sizeB = getHeader( b ) >> 3; // The size of the second block
 
-        // Check the block size is greater than 16
-        if ( fullSize > ALIGNMENT )
-        {
-            mem_memcpy( block + ALIGNMENT/2, &pred, sizeof(pred) );
-            mem_memcpy( block + ALIGNMENT, &succ, sizeof(succ) );
-        }
-    }
-    else if ( valid == 2 )
-    {
-        // Check the predecessor is 1
-        if ( pred == (char *)1 )
-            mem_memcpy( block + ALIGNMENT, &succ, sizeof(succ) );
-        else if ( succ == (char *)1 )
-            mem_memcpy( block + ALIGNMENT/2, &pred, sizeof(pred) );
-    }
-    return;
+    return sizeA < sizeB || ( sizeA == sizeB && a < b );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : findFirst0
-// Description  : Find the first free block in the slab
+// Function     : treePriority
+// Description  : Get the priority of a block in the treap. It is a hash of the
+//                address, so it does not need to be stored in the block
 //
-// Inputs       : num - a portion of a bitmap
-// Outputs      : the index of the first free block in the slab
-static uint64_t findFirst0( uint64_t num )
+// Inputs       : block - the free block
+// Outputs      : the priority
+static inline uint32_t treePriority( char *block )
 {
-    if ( (num >> 32) )
-        return floor( log2( num >> 32 ) ) + 32;
-    else
-        return floor( log2( num << 32 >> 32 ) );
+    return (uint32_t)( ( (uintptr_t)block * 0x9E3779B97F4A7C15ull ) >> 32 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : slabAdd
-// Description  : Add a block in a slab
+// Function     : treeSplit
+// Description  : Split a subtree into the blocks before a key and the blocks
+//                after it
 //
-// Inputs       : size - the size of the block
-// Outputs      : the address of the block or NULL
-static char *slabAdd( size_t size )
+// Inputs       : node - the root of the subtree
+//                key - the block to split at
+//                left - the link for the blocks before the key
+//                right - the link for the blocks after the key
+// Outputs      : nothing
+static void treeSplit( char *node, char *key, char **left, char **right )
 {
-    // Check the block size is 16
-    if ( size == ALIGNMENT )
+    // Check the subtree is empty
+    if ( !node )
     {
-        bool toBeAlloc = false; // The boolean variable to show the allocate status of the block
-
-        // Loop through the slab16
-        for ( int i = 9; i > -1; --i )
-        {
-            // Find the block in slab16 is not null
-            if ( slabs16[i] )
-            {
-                int num = 0; // Number of maps 
-
-                // Check the index is greater than 8
-                if ( i > 8 )
-                    num = 32;
-                else
-                    num = 8;
-                uint64_t maps[num]; // The bitmap
-
-                // Loop through the maps
-                for (int j = 0; j < num; ++j)
-                {
-                    mem_memcpy( &maps[j], slabs16[i] + j*ALIGNMENT/2, sizeof(maps[j]) );
-
-                    // Check the bitmap is full
-                    if ( maps[j] != ( maps[j] | -1 ) )
-                    {
-                        uint64_t first0 = findFirst0( ( maps[j] | -1 ) - maps[j] ); // The index of the first free block
-                        maps[j] += ( (maps[j] & 0) | 1 ) << first0;
-                        mem_memcpy( slabs16[i] + j*ALIGNMENT/2, &maps[j], sizeof(maps[j]) );
-                        return slabs16[i] + (num+1)/2*ALIGNMENT + j*1024 + (63-first0)*ALIGNMENT;
-                    }
-                }
-            }
-            else toBeAlloc = true;
-        }
-
-        // Check the block will be allocate
-        if ( toBeAlloc )
-        {
-            // Loop through the slabs16
-            for (int i = 0; i < 10; ++i)
-            {
-                // Find the first null blook in slabs16
-                if ( !slabs16[i] )
-                {
-                    int num = ((i&0)|1) << i; // Number of the size
-
-                    // Check the index is greater than 8
-                    if ( i > 8 )
-                        num = 32;
-                    else
-                        num = 8;
-                    slabs16[i] = malloc( num*1024 + num * ALIGNMENT/2 );
-                    uint64_t map = 1; // The bitmap
-                    map = map << 63;
-                    mem_memcpy( slabs16[i], &map, sizeof(map) );
-                    map = 0;
-
-                    // Allocate the memory 
-                    for ( int j = 1; j < num; ++j )
-                        mem_memcpy( slabs16[i] + j*ALIGNMENT/2, &map, sizeof(map) );
-                    return slabs16[i] + (num+1)/2 * ALIGNMENT;
-                }
-            }
-        }
+        *left = NULL;
+        *right = NULL;
+        return;
     }
 
-    else if ( size == 2*ALIGNMENT )
+    // Check the node comes before the key
+    if ( treeLess( node, key ) )
     {
-        bool toBeAlloc = false; // // The boolean variable to show the allocate status of the block
-
-        // Loop through the slab32
-        for ( int i = 13; i > -1; --i )
-        {
-            // Find the block in slab16 is not null
-            if ( slabs32[i] )
-            {
-                int num = ( (i & 0) | 1 ) << i; // Number of maps
-
-                // Check the index is greater than 8
-                if ( i > 8 )
-                    num = 32;
-                else
-                    num = 8;
-                uint64_t maps[num]; // The bitmap
+        *left = node;
+        treeSplit( *treeRight( node ), key, treeRight( node ), right );
+    }
+    else
+    {
+        *right = node;
+        treeSplit( *treeLeft( node ), key, left, treeLeft( node ) );
+    }
+    return;
+}
 
-                // Loop through the maps
-                for (int j = 0; j < num; ++j)
-                {
-                    mem_memcpy( &maps[j], slabs32[i] + j*ALIGNMENT/2, sizeof(maps[j]) );
-
-                    // Check the bitmap is full
-                    if ( maps[j] != ( maps[j] | -1 ) )
-                    {
-                        uint64_t first0 = findFirst0( ( maps[j] | -1 ) - maps[j] ); // The index of the first free block
-                        maps[j] += ( (maps[j] & 0) | 1 ) << first0;
-                        mem_memcpy( slabs32[i] + j*ALIGNMENT/2, &maps[j], sizeof(maps[j]) );
-                        return slabs32[i] + (num+1)/2*ALIGNMENT + j*2048 + (63-first0)*2*ALIGNMENT;
-                    }
-                }
-            }
-            else toBeAlloc = true;
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : treeMerge
+// Description  : Merge two subtrees, where every block of the left one comes
+//                before every block of the right one
+//
+// Inputs       : left - the left subtree
+//                right - the right subtree
+// Outputs      : the root of the merged subtree
+static char *treeMerge( char *left, char *right )
+{
+    // Check one of the subtrees is empty
+    if ( !left )
+        return right;
+    if ( !right )
+        return left;
 
-        // Check the block will be allocate
-        if ( toBeAlloc )
-        {
-            // Loop through the slab32
-            for (int i = 0; i < 14; ++i)
-            {
-                // Find the first null blook in slabs32
-                if ( !slabs32[i] )
-                {
-                    int num = ((i&0)|1) << i; // The number of the maps
-
-                    // Check the index is greater than 8
-                    if ( i > 8 )
-                        num = 32;
-                    else
-                        num = 8;
-                    slabs32[i] = malloc( num*2048 + num * ALIGNMENT/2 );
-                    uint64_t map = 1; // The bitmap
-                    map = map << 63;
-                    mem_memcpy( slabs32[i], &map, sizeof(map) );
-                    map = 0;
-
-                    // Allocate the memory 
-                    for ( int j = 1; j < num; ++j )
-                        mem_memcpy( slabs32[i] + j*ALIGNMENT/2, &map, sizeof(map) );
-                    return slabs32[i] + (num+1)/2 * ALIGNMENT;
-                }
-            }
-        }
+    // Check the left root has the higher priority
+    if ( treePriority( left ) > treePriority( right ) )
+    {
+        *treeRight( left ) = treeMerge( *treeRight( left ), right );
+        return left;
     }
 
-    return NULL;
+    *treeLeft( right ) = treeMerge( left, *treeLeft( right ) );
+    return right;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : slabDelete
-// Description  : Delete a block in a slab
+// Function     : treeAdd
+// Description  : Add a free block to the tree
 //
-// Inputs       : addr - the address of the block that needs to be deleted
-//                size - the size of the block that needs to be deleted
-//                index - the index of the block that needs to be deleted
+// Inputs       : root - the link to the root of the tree
+//                block - the free block
 // Outputs      : nothing
-static void slabDelete( char *addr, uint8_t size, uint8_t index )
+static void treeAdd( char **root, char *block )
 {
-    // Check the size of the block is 16
-    if ( size == ALIGNMENT )
-    {
-        uint64_t num = 1; // the number of maps 
-        num = num << index;
+    char **link = root; // The link where the block goes
+    uint32_t priority = treePriority( block ); // The priority of the block
 
-        // Check the index is greater than 8
-        if ( index > 8 )
-            num = 32;
-        else
-            num = 8;
-        uint64_t mapIndex = ( addr - slabs16[index] - (num+1)/2*ALIGNMENT )/1024; // The index of a bitmap
-        uint64_t tmp = 1; // The temporary variable
-        tmp = tmp << (63 - ( addr - slabs16[index] - (num+1)/2*ALIGNMENT - mapIndex*1024 )/16 );
-        uint64_t map = 0; // The bitmap
-        mem_memcpy( &map, slabs16[index] + mapIndex*ALIGNMENT/2, sizeof(map) );
-        map -= tmp;
-        mem_memcpy( slabs16[index] + mapIndex*ALIGNMENT/2, &map, sizeof(map) );
+    // Go down while the nodes have higher priority than the block
+    while ( *link && treePriority( *link ) >= priority )
+        link = treeLess( block, *link ) ? treeLeft( *link ) : treeRight( *link );
 
-        bool isFree = true; // The boolean variable to record the status
+    treeSplit( *link, block, treeLeft( block ), treeRight( block ) );
+    *link = block;
+    return;
+}
 
-        // Loop through the bitmap
-        for ( int i = 0; i < (int)num; ++i )
-        {
-            mem_memcpy( &map, slabs16[index] + i*ALIGNMENT/2, sizeof(map) );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : treeDelete
+// Description  : Delete a free block from the tree
+//
+// Inputs       : root - the link to the root of the tree
+//                block - the free block
+// Outputs      : nothing
+static void treeDelete( char **root, char *block )
+{
+    char **link = root; // The link to the block
 
-            // Check whether the map is not free
-            if ( map )
-            {
-                isFree = false;
-                break;
-            }
-        }
-        // Check the isFree boolean variable is free
-        if ( isFree )
-        {
-            free( slabs16[index] );
-            slabs16[index] = NULL;
-        }
-        return;
-    }
-    else if ( size == 2*ALIGNMENT )
-    {
-        uint64_t num = 1; // the number of bitmap
-        num = num << index;
+    // Go down to the block
+    while ( *link != block )
+        link = treeLess( block, *link ) ? treeLeft( *link ) : treeRight( *link );
 
-        // Check the index is greater than 8
-        if ( index > 8 )
-            num = 32;
-        else
-            num = 8;
-        uint64_t mapIndex = ( addr - slabs32[index] - (num+1)/2*ALIGNMENT )/2048; // The index of a bitmap
-        uint64_t tmp = 1; // The temporary variable
-        tmp = tmp << (63 - ( addr - slabs32[index] - (num+1)/2*ALIGNMENT - mapIndex*2048 )/32 );
-        uint64_t map = 0; // The bitmap
-        mem_memcpy( &map, slabs32[index] + mapIndex*ALIGNMENT/2, sizeof(map) );
-        map -= tmp;
-        mem_memcpy( slabs32[index] + mapIndex*ALIGNMENT/2, &map, sizeof(map) );
+    *link = treeMerge( *treeLeft( block ), *treeRight( block ) );
+    return;
+}
 
-        bool isFree = true; // The boolean variable to record the status
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : treeFit
+// Description  : Find the best fit in the tree, the smallest block, and then the
+//                lowest address, that holds a size
+//
+// Inputs       : node - the root of the tree
+//                size - the size of the block
+// Outputs      : the best block, or null if no block is big enough
+static char *treeFit( char *node, size_t size )
+{
+    char *best = NULL; // The best block so far
 
-        // Loop through the bitmap
-        for ( int i = 0; i < (int)num; ++i )
+    while ( node )
+    {
+        // Check the block is big enough, then look for a smaller one
+        if ( ( getHeader( node ) >> 3 ) >= size )
         {
-            mem_memcpy( &map, slabs32[index] + i*ALIGNMENT/2, sizeof(map) );
-
-            // Check whether the map is not free
-            if ( map )
-            {
-                isFree = false;
-                break;
-            }
+            best = node;
+            node = *treeLeft( node );
         }
-        // Check the isFree boolean variable is free
-        if ( isFree )
+        else
         {
-            free( slabs32[index] );
-            slabs32[index] = NULL;
+            node = *treeRight( node );
         }
-        return;
     }
-    return;
+    return best;
 }
 
-/* rounds up to the nearest multiple of ALIGNMENT */
-static size_t align(size_t x)
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentLeft
+// Description  : Get the link to the left child of an extent in the tree of
+//                extents, which is ordered by address
+//
+// Inputs       : block - the extent
+// Outputs      : the link to the left child
+static inline char **extentLeft( char *block )
 {
-    return ALIGNMENT * ((x+ALIGNMENT-1)/ALIGNMENT);
+    return (char **)block + EXTENT_LEFT;
 }
 
-/*
- * Initialize: returns false on error, true on success.
- */
-bool mm_init( void )
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentRight
+// Description  : Get the link to the right child of an extent in the tree of
+//                extents
+//
+// Inputs       : block - the extent
+// Outputs      : the link to the right child
+static inline char **extentRight( char *block )
 {
-    /* IMPLEMENT THIS */
-    lists = mem_sbrk( ALIGNMENT/2*36 );
-    slabs16 = mem_sbrk( ALIGNMENT/2*10 );
-    slabs32 = mem_sbrk( ALIGNMENT/2*15 );
+    return (char **)block + EXTENT_RIGHT;
+}
 
-    // Initialize the segregate free list
-    for ( int i = 0; i < 36; ++i )
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentMax
+// Description  : Get the size of the largest block in a subtree of the tree of
+//                extents
+//
+// Inputs       : node - the root of the subtree
+// Outputs      : the largest size, or 0 if the subtree is empty
+static inline size_t extentMax( char *node )
+{
+    return node ? ((uint64_t *)node)[EXTENT_MAX] : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentUpdate
+// Description  : Recalculate the largest size in the subtree of a node from its
+//                children
+//
+// Inputs       : node - the node
+// Outputs      : nothing
+static inline void extentUpdate( char *node )
+{
+    size_t max = getHeader( node ) >> 3; // The largest size in the subtree
+
+    // Check a child has a larger block
+    if ( extentMax( *extentLeft( node ) ) > max )
+        max = extentMax( *extentLeft( node ) );
+    if ( extentMax( *extentRight( node ) ) > max )
+        max = extentMax( *extentRight( node ) );
+    ((uint64_t *)node)[EXTENT_MAX] = max;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentSplit
+// Description  : Split a subtree of the tree of extents into the blocks below an
+//                address and the blocks above it
+//
+// Inputs       : node - the root of the subtree
+//                key - the address to split at
+//                left - the link for the blocks below the key
+//                right - the link for the blocks above the key
+// Outputs      : nothing
+static void extentSplit( char *node, char *key, char **left, char **right )
+{
+    // Check the subtree is empty
+    if ( !node )
     {
-        lists[i] = NULL;
+        *left = NULL;
+        *right = NULL;
+        return;
     }
 
-    // Initializa the slabs
-    for ( int i = 0; i < 10; ++i )
+    // Check the node is below the key
+    if ( node < key )
     {
-        slabs16[i] = NULL;
+        *left = node;
+        extentSplit( *extentRight( node ), key, extentRight( node ), right );
     }
-
-    for ( int i = 0; i < 14; ++i )
+    else
     {
-        slabs32[i] = NULL;
+        *right = node;
+        extentSplit( *extentLeft( node ), key, left, extentLeft( node ) );
     }
+    extentUpdate( node );
+    return;
+}
 
-
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentMerge
+// Description  : Merge two subtrees of the tree of extents, where every block of
+//                the left one is below every block of the right one
+//
+// Inputs       : left - the left subtree
+//                right - the right subtree
+// Outputs      : the root of the merged subtree
+static char *extentMerge( char *left, char *right )
+{
+    // Check one of the subtrees is empty
+    if ( !left )
+        return right;
+    if ( !right )
+        return left;
+
+    // Check the left root has the higher priority
+    if ( treePriority( left ) > treePriority( right ) )
+    {
+        *extentRight( left ) = extentMerge( *extentRight( left ), right );
+        extentUpdate( left );
+        return left;
+    }
+
+    *extentLeft( right ) = extentMerge( left, *extentLeft( right ) );
+    extentUpdate( right );
+    return right;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentAdd
+// Description  : Add an extent to the tree of extents, as a new one
+//
+// Inputs       : block - the extent
+// Outputs      : nothing
+static void extentAdd( char *block )
+{
+    char **link = &extents; // The link where the block goes
+    uint32_t priority = treePriority( block ); // The priority of the block
+    size_t size = getHeader( block ) >> 3; // The size of the block
+
+    // Go down while the nodes have higher priority than the block, which joins
+    // their subtrees
+    while ( *link && treePriority( *link ) >= priority )
+    {
+        // Check the block is the largest in the subtree
+        if ( extentMax( *link ) < size )
+            ((uint64_t *)*link)[EXTENT_MAX] = size;
+        link = block < *link ? extentLeft( *link ) : extentRight( *link );
+    }
+
+    extentSplit( *link, block, extentLeft( block ), extentRight( block ) );
+    extentUpdate( block );
+    ((uint64_t *)block)[EXTENT_AGE] = 0;
+    *link = block;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentDelete
+// Description  : Delete an extent from a subtree of the tree of extents
+//
+// Inputs       : node - the root of the subtree
+//                block - the extent
+// Outputs      : the root of the subtree without the block
+static char *extentDelete( char *node, char *block )
+{
+    // Check the node is the block
+    if ( node == block )
+        return extentMerge( *extentLeft( block ), *extentRight( block ) );
+
+    // Check the block is below the node
+    if ( block < node )
+        *extentLeft( node ) = extentDelete( *extentLeft( node ), block );
+    else
+        *extentRight( node ) = extentDelete( *extentRight( node ), block );
+    extentUpdate( node );
+    return node;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentFit
+// Description  : Find the extent at the lowest address that holds a size, going
+//                down to the left subtree whenever it has one
+//
+// Inputs       : size - the size of the block
+// Outputs      : the block, or null if no block is big enough
+static char *extentFit( size_t size )
+{
+    char *node = extents; // The root of the subtree with the fit
+
+    // Check no block is big enough
+    if ( extentMax( node ) < size )
+        return NULL;
+
+    while ( true )
+    {
+        // Check a block below the node is big enough
+        if ( extentMax( *extentLeft( node ) ) >= size )
+            node = *extentLeft( node );
+        else if ( ( getHeader( node ) >> 3 ) >= size )
+            return node;
+        else
+            node = *extentRight( node );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentPurge
+// Description  : Age the extents of a subtree of the tree of extents, from the
+//                lowest address up, and give back the pages inside the ones that
+//                were in the tree at the last purge already, except their tags. A
+//                new extent is likely to be taken again soon, so it waits, and the
+//                free tail of the heap is left to trimming
+//
+// Inputs       : node - the root of the subtree
+// Outputs      : nothing
+static void extentPurge( char *node )
+{
+    // Check the subtree is empty
+    if ( !node )
+        return;
+
+    extentPurge( *extentLeft( node ) );
+
+    size_t size = getHeader( node ) >> 3; // The size of the extent
+
+    // Check the extent is not the free tail, which trimming looks after, has waited
+    // for one purge, and its pages are not given back yet
+    if ( in_heap( node + size ) && ++((uint64_t *)node)[EXTENT_AGE] == 2 )
+    {
+        mem_release( node + EXTENT_WORDS*ALIGNMENT/2, size - ( EXTENT_WORDS + 1 )*ALIGNMENT/2 );
+    }
+
+    extentPurge( *extentRight( node ) );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listDelete
+// Description  : Delete a block from the segregate free list
+//
+// Inputs       : block - the block that needs to be deleted
+//                index - the index of the list 
+// Outputs      : nothing
+static void listDelete( char *block, uint8_t index )
+{
+    // Check the block is the designated victim, which is forgotten
+    if ( block == victim )
+        victim = NULL;
+
+    // Check the block is the free tail waiting for its trim, which is needed after all
+    if ( block == trimTail )
+        trimTail = NULL;
+
+    --listCounts[index];
+    listBytes[index] -= getHeader( block ) >> 3;
+
+    // Check the block is in the tree of large free blocks
+    if ( index == TREE_CLASS )
+    {
+        treeDelete( &lists[index], block );
+
+        // Check the block is an extent
+        if ( ( getHeader( block ) >> 3 ) >= EXTENT_MIN )
+            extents = extentDelete( extents, block );
+
+        // Check the tree becomes empty
+        if ( !lists[index] )
+            nonEmpty[index >> 6] &= ~( 1ull << (index & 63) );
+        return;
+    }
+
+    char *pred = getPred( block ); // The predecessor of the block
+    char *succ = getSucc( block ); // The successor of the block
+
+    // Check next fit would look at the block first, and move on to its successor
+    if ( block == rover )
+        rover = succ;
+
+    // Check whether the predecessor is NULL
+    if ( !pred )
+    {
+        lists[index] = succ;
+
+        // Check the list becomes empty
+        if ( !succ )
+            nonEmpty[index >> 6] &= ~( 1ull << (index & 63) );
+    }
+    else
+    {
+        setSucc( pred, succ );
+    }
+
+    // Check whether the successor is NULL
+    if ( succ )
+        setPred( succ, pred );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listAdd
+// Description  : Add a block to the front of the segregate free list, or in front
+//                of the first block above it with address-ordered first fit
+//
+// Inputs       : addr - the address of the block
+//                index - the index of the list 
+// Outputs      : nothing
+static void listAdd( char *addr, uint8_t index )
+{
+    ++listCounts[index];
+    listBytes[index] += getHeader( addr ) >> 3;
+
+    // Check the block goes into the tree of large free blocks
+    if ( index == TREE_CLASS )
+    {
+        treeAdd( &lists[index], addr );
+
+        // Check the block is an extent
+        if ( ( getHeader( addr ) >> 3 ) >= EXTENT_MIN )
+            extentAdd( addr );
+        nonEmpty[index >> 6] |= 1ull << (index & 63);
+        return;
+    }
+
+    // Check the lists are ordered by address, and the block goes behind the first one
+    if ( policy == MM_ADDRESS_FIT && lists[index] && lists[index] < addr )
+    {
+        char *pred = lists[index]; // The last block below the new one
+
+        while ( getSucc( pred ) && getSucc( pred ) < addr )
+            pred = getSucc( pred );
+
+        char *succ = getSucc( pred ); // The first block above the new one
+        setPred( addr, pred );
+        setSucc( addr, succ );
+        setSucc( pred, addr );
+
+        // Check the new block is not the last one
+        if ( succ )
+            setPred( succ, addr );
+        return;
+    }
+
+    setPred( addr, NULL );
+    setSucc( addr, lists[index] );
+
+    // Check the list is not empty
+    if ( lists[index] )
+        setPred( lists[index], addr );
+    lists[index] = addr;
+    nonEmpty[index >> 6] |= 1ull << (index & 63);
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getIndex
+// Description  : Calculate the size class of the block. Every power of two is split into
+//                CLASSES_PER_POW classes by the bits right below the leading one, so the
+//                class lower bounds are 32, 48, 64, 80, 96, 112, 128, 160, ..., 3584.
+//                Every block of 2^TREE_EXP bytes or more is in the class of the tree
+//
+// Inputs       : size - the size of the block
+// Outputs      : The index of the block
+static uint8_t getIndex( size_t size )
+{
+    // Check the size is smaller than the first class
+    if ( size < 2*ALIGNMENT )
+        return 0;
+
+    int exp = 63 - __builtin_clzll( size ); // The position of the leading one
+
+    // Check the block is large enough for the tree
+    if ( exp >= TREE_EXP )
+        return TREE_CLASS;
+
+    return (uint8_t)( ( exp - 5 ) * CLASSES_PER_POW +
+                      ( ( size >> ( exp - CLASS_BITS ) ) & ( CLASSES_PER_POW - 1 ) ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findClass
+// Description  : Find the first non-empty segregate free list from a class on
+//
+// Inputs       : from - the first class to look at
+// Outputs      : the index of the non-empty list or -1 if there is none
+static int findClass( int from )
+{
+    // Check the class is out of range
+    if ( from >= NUM_CLASSES )
+        return -1;
+
+    uint64_t bits = nonEmpty[from >> 6] & ( -1ull << (from & 63) ); // The candidates in the first word
+
+    // Loop through the words of the bitmap
+    for ( int word = from >> 6; ; bits = nonEmpty[word] )
+    {
+        // Check there is a non-empty list in this word
+        if ( bits )
+            return word*64 + __builtin_ctzll( bits );
+
+        // Check this is the last word
+        if ( ++word == MAP_WORDS )
+            return -1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addTags
+// Description  : Add the tags for the block. An allocated block only has a header,
+//                and both keep the bit of whether the previous block is allocated
+//
+// Inputs       : block - the block
+//                valid - the status of whether the block is valid
+//                fullsize - the size of the block
+// Outputs      : nothing
+static inline void addTags( char *block, uint8_t valid, size_t fullSize )
+{
+    uint64_t header = ( fullSize << 3 ) | ( getHeader( block ) & PREV_ALLOC ) | valid; // The header of the block
+    putHeader( block, header );
+
+    // Check the block is free, and give it a footer. Leave the payload of an
+    // allocated block alone, so that realloc() can resize it in place
+    if ( !valid )
+        putFooter( block, header );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropFooter
+// Description  : Clear the footer in front of an address that is no longer the
+//                footer of the free tail, so the memory past zeroFrom stays zero
+//
+// Inputs       : end - the old end of the free tail of the heap
+// Outputs      : nothing
+static inline void dropFooter( char *end )
+{
+    // Check the footer is in the memory known to be zero
+    if ( end - ALIGNMENT/2 >= zeroFrom )
+        *(uint64_t *)( end - ALIGNMENT/2 ) = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropTags
+// Description  : Clear the header and the links of a free block that is taken
+//                into the block in front of it, so the memory past zeroFrom
+//                stays zero. Moving zeroFrom instead would not do: calloc()
+//                looks at zeroFrom before malloc() merges the blocks
+//
+// Inputs       : block - the free block
+//                size - the size of the free block
+// Outputs      : nothing
+static inline void dropTags( char *block, size_t size )
+{
+    char *end = block + ( size >= EXTENT_MIN ? EXTENT_WORDS*ALIGNMENT/2 :
+                          size > ALIGNMENT ? 3*ALIGNMENT/2 : ALIGNMENT/2 ); // The end of the tags
+
+    for ( char *word = block; word < end; word += ALIGNMENT/2 )
+    {
+        // Check the word is in the memory known to be zero
+        if ( word >= zeroFrom )
+            *(uint64_t *)word = 0;
+    }
+}
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+static size_t align(size_t x)
+{
+    return ALIGNMENT * ((x+ALIGNMENT-1)/ALIGNMENT);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockSize
+// Description  : Get the size of the block of a payload, with its header
+//
+// Inputs       : size - the size of the payload
+// Outputs      : the size of the block
+static size_t blockSize( size_t size )
+{
+    // Check the blocks are buddies, whose sizes are powers of two
+    if ( backend == MM_BUDDY )
+        return 1ull << buddyOrder( size );
+
+    return align( size + ALIGNMENT/2 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setPrevAlloc
+// Description  : Record in the header of a block whether the block in front of it
+//                is allocated. At the end of the heap, there is no block yet, and
+//                we record it for the next block that extends the heap
+//
+// Inputs       : block - the block
+//                alloc - whether the previous block is allocated
+// Outputs      : nothing
+static void setPrevAlloc( char *block, bool alloc )
+{
+    // Check the block is at the end of the heap
+    if ( !in_heap( block ) )
+    {
+        lastAlloc = alloc;
+        return;
+    }
+
+    uint64_t header = getHeader( block ); // The header of the block
+    putHeader( block, alloc ? header | PREV_ALLOC : header & ~(uint64_t)PREV_ALLOC );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : isPrevAlloc
+// Description  : Check whether the block in front of a block is allocated
+//
+// Inputs       : block - the block
+// Outputs      : whether the previous block is allocated
+static bool isPrevAlloc( char *block )
+{
+    // Check the block is at the end of the heap
+    if ( !in_heap( block ) )
+        return lastAlloc;
+
+    return getHeader( block ) & PREV_ALLOC;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabClass
+// Description  : Get the slab class of a payload size. Class i holds objects of
+//                (i+1)*16 bytes
+//
+// Inputs       : size - the payload size, at most SLAB_MAX
+// Outputs      : the slab class
+static uint8_t slabClass( size_t size )
+{
+    // Check the size is 0
+    if ( !size )
+        return 0;
+
+    return (uint8_t)( (size - 1) / ALIGNMENT );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabHeadSize
+// Description  : Get the size of the head of a slab: the partial list links, the
+//                information word, the used counter and the occupancy bitmap
+//
+// Inputs       : count - the number of objects in the slab
+// Outputs      : the size of the head, which keeps the objects aligned
+static size_t slabHeadSize( size_t count )
+{
+    return align( SLAB_MAP*sizeof(uint64_t) + (count + 63)/64*sizeof(uint64_t) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabObjects
+// Description  : Get the number of objects that fit in a slab of a class
+//
+// Inputs       : cls - the slab class
+// Outputs      : the number of objects
+static size_t slabObjects( uint8_t cls )
+{
+    size_t room = SLAB_BYTES - ALIGNMENT; // The payload of the slab's block
+    size_t count = room / ( (cls + 1)*ALIGNMENT ); // The number of objects
+
+    // Make room for the head
+    while ( slabHeadSize( count ) + count*(cls + 1)*ALIGNMENT > room )
+        --count;
+
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partialDelete
+// Description  : Remove a slab from the partial slab list of its class
+//
+// Inputs       : slab - the head of the slab
+//                dir - the directory of the slab's class
+// Outputs      : nothing
+static void partialDelete( uint64_t *slab, uint64_t *dir )
+{
+    uint64_t *next = (uint64_t *)slab[SLAB_NEXT]; // The next partial slab
+    uint64_t *prev = (uint64_t *)slab[SLAB_PREV]; // The previous partial slab
+
+    // Check the slab is the first partial slab
+    if ( prev )
+        prev[SLAB_NEXT] = (uint64_t)next;
+    else
+        dir[DIR_PARTIAL] = (uint64_t)next;
+
+    // Check the slab is not the last partial slab
+    if ( next )
+        next[SLAB_PREV] = (uint64_t)prev;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partialAdd
+// Description  : Put a slab at the front of the partial slab list of its class
+//
+// Inputs       : slab - the head of the slab
+//                dir - the directory of the slab's class
+// Outputs      : nothing
+static void partialAdd( uint64_t *slab, uint64_t *dir )
+{
+    slab[SLAB_NEXT] = dir[DIR_PARTIAL];
+    slab[SLAB_PREV] = 0;
+
+    // Check the list is not empty
+    if ( dir[DIR_PARTIAL] )
+        ((uint64_t *)dir[DIR_PARTIAL])[SLAB_PREV] = (uint64_t)slab;
+    dir[DIR_PARTIAL] = (uint64_t)slab;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabMark
+// Description  : Mark or unmark the heap page of a slab in the bitmap of slab
+//                pages, and grow the bitmap if the page is past its end
+//
+// Inputs       : slab - the head of the slab, at the start of a page
+//                used - whether the page holds the slab from now on
+// Outputs      : false if there is no memory for a larger bitmap
+static bool slabMark( uint64_t *slab, bool used )
+{
+    size_t page = (uintptr_t)slab / SLAB_BYTES - heapPage; // The page of the slab
+
+    // Check the page is past the end of the bitmap
+    if ( page/64 >= slabPageWords )
+    {
+        size_t words = 2*slabPageWords; // The new number of words
+        if ( words <= page/64 )
+            words = page/64 + 1;
+
+        uint64_t *pages = blockAdd( words*sizeof(uint64_t) ); // The new bitmap
+
+        // Check there is no memory for the new bitmap
+        if ( !pages )
+            return false;
+
+        for ( size_t i = 0; i < words; ++i )
+            pages[i] = i < slabPageWords ? slabPages[i] : 0;
+
+        // Check there is an old bitmap
+        if ( slabPages )
+            blockDelete( slabPages );
+        slabPages = pages;
+        slabPageWords = words;
+    }
+
+    // Check the page is used. Other arenas look the bits up without a lock
+    if ( used )
+        __atomic_fetch_or( &slabPages[page/64], 1ull << (page % 64), __ATOMIC_RELEASE );
+    else
+        __atomic_fetch_and( &slabPages[page/64], ~( 1ull << (page % 64) ), __ATOMIC_RELEASE );
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabFind
+// Description  : Find the slab that holds a block. Slabs fill whole aligned
+//                pages, so the page of the block and one load from the bitmap of
+//                slab pages tell whether it is in a slab
+//
+// Inputs       : addr - the address of the block
+// Outputs      : the head of the slab or NULL if the block is not in a slab
+static uint64_t *slabFind( char *addr )
+{
+    size_t page = (uintptr_t)addr / SLAB_BYTES - heapPage; // The page of the block
+
+    // Check the page holds a slab
+    if ( page/64 < slabPageWords &&
+         ( __atomic_load_n( &slabPages[page/64], __ATOMIC_ACQUIRE ) >> (page % 64) & 1 ) )
+        return (uint64_t *)( (uintptr_t)addr & ~(uintptr_t)( SLAB_BYTES - 1 ) );
+
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dirGrow
+// Description  : Chain a new node to a slab directory, or make the first node of
+//                a directory, and push its slots onto the stack of empty slots.
+//                An empty slot holds the next empty slot with the low bit set, so
+//                it is never taken for a slab, whose head is page aligned
+//
+// Inputs       : dir - the first node of the directory, or NULL for a new one
+// Outputs      : the first node of the directory, or NULL if there is no memory
+//                for a new one
+static uint64_t *dirGrow( uint64_t *dir )
+{
+    heapLock();
+    uint64_t *node = blockAdd( DIR_WORDS*sizeof(uint64_t) ); // The new node
+    heapUnlock();
+
+    // Check there is no memory for the node, and leave the directory as it is
+    if ( !node )
+        return dir;
+
+    // Check the node is the first one, which holds the head of the directory
+    if ( !dir )
+    {
+        dir = node;
+        for ( int i = 0; i < DIR_SLOTS; ++i )
+            dir[i] = 0;
+    }
+    else
+    {
+        node[DIR_NEXT] = dir[DIR_NEXT];
+        dir[DIR_NEXT] = (uint64_t)node;
+    }
+
+    // Push the slots from the last, so the first slot is taken first
+    for ( int i = DIR_WORDS - 1; i >= DIR_SLOTS; --i )
+    {
+        node[i] = dir[DIR_EMPTY] | 1;
+        dir[DIR_EMPTY] = (uint64_t)&node[i];
+    }
+    return dir;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabNew
+// Description  : Create an empty slab in the first empty slot of a directory,
+//                growing the directory if it is full, and put it on the partial
+//                slab list
+//
+// Inputs       : index - the directory of the slab, its class plus SLAB_CLASSES
+//                        for short-lived objects
+//                dir - the directory
+// Outputs      : the head of the slab, or NULL if there is no memory for it
+static uint64_t *slabNew( uint8_t index, uint64_t *dir )
+{
+    uint8_t cls = index % SLAB_CLASSES; // The slab class
+
+    // Check every slot of the directory holds a slab, and the directory cannot grow
+    if ( !dir[DIR_EMPTY] && !dirGrow( dir )[DIR_EMPTY] )
+        return NULL;
+
+    uint64_t *slot = (uint64_t *)dir[DIR_EMPTY]; // The first empty slot
+    size_t count = slabObjects( cls ); // The number of objects
+    size_t words = (count + 63)/64; // The number of words in the bitmap
+    heapLock();
+    uint64_t *slab = blockAlign( SLAB_BYTES - ALIGNMENT, SLAB_BYTES );
+
+    // Check there is no memory for the slab, or for the bitmap of the slab pages
+    if ( slab && !slabMark( slab, true ) )
+    {
+        blockDelete( slab );
+        slab = NULL;
+    }
+    heapUnlock();
+
+    if ( !slab )
+        return NULL;
+
+    slab[SLAB_INFO] = cls | (uint64_t)( index / SLAB_CLASSES ) << SLAB_SHORT | (uint64_t)count << 16 |
+                      (uint64_t)arenaId << 32;
+    slab[SLAB_USED] = 0;
+    slab[SLAB_SLOT] = (uint64_t)slot;
+
+    // Clear the bitmap, and mark the bits past the last object as used
+    for ( size_t i = 0; i < words; ++i )
+        slab[SLAB_MAP + i] = 0;
+    if ( count % 64 )
+        slab[SLAB_MAP + words - 1] = -1ull << (count % 64);
+
+    dir[DIR_EMPTY] = *slot & ~1ull;
+    *slot = (uint64_t)slab;
+    ++dir[DIR_SLABS];
+    partialAdd( slab, dir );
+    return slab;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabDir
+// Description  : Get a slab directory, and make it the first time
+//
+// Inputs       : index - the directory, the slab class plus SLAB_CLASSES for
+//                        short-lived objects
+// Outputs      : the directory, or NULL if there is no memory for it
+static uint64_t *slabDir( uint8_t index )
+{
+    // Check the class has no directory yet
+    if ( !slabDirs[index] )
+        slabDirs[index] = dirGrow( NULL );
+
+    return slabDirs[index];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabIndex
+// Description  : Get the directory of a slab
+//
+// Inputs       : slab - the head of the slab
+// Outputs      : the slab class, plus SLAB_CLASSES for short-lived objects
+static uint8_t slabIndex( uint64_t *slab )
+{
+    return ( slab[SLAB_INFO] & 0xff ) + ( slab[SLAB_INFO] >> SLAB_SHORT & 1 )*SLAB_CLASSES;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabAdd
+// Description  : Add a block in a slab, of the short-lived objects of its class
+//                or of the others
+//
+// Inputs       : size - the size of the block
+//                shortLived - whether the block is expected to be freed soon
+// Outputs      : the address of the block
+static char *slabAdd( size_t size, bool shortLived )
+{
+    uint8_t cls = slabClass( size ); // The slab class of the block
+    uint8_t index = cls + shortLived*SLAB_CLASSES; // The directory of the block
+    uint64_t *dir = slabDir( index ); // The directory
+
+    // Check there is no memory for the directory
+    if ( !dir )
+        return NULL;
+
+    uint64_t *slab = (uint64_t *)dir[DIR_PARTIAL]; // The first slab with a free object
+
+    // Check there is no partial slab, and no memory for a new one
+    if ( !slab && !( slab = slabNew( index, dir ) ) )
+        return NULL;
+
+    size_t count = ( slab[SLAB_INFO] >> 16 ) & 0xffff; // The number of objects in the slab
+    uint64_t *map = slab + SLAB_MAP; // The bitmap
+
+    // Skip the full words of the bitmap; a partial slab always has a free object
+    while ( !~*map )
+        ++map;
+
+    uint64_t bit = __builtin_ctzll( ~*map ); // The first free object in the word
+    *map |= 1ull << bit;
+
+    ++dir[DIR_USED];
+    ++dir[DIR_ALLOCS];
+
+    // Check the slab becomes full
+    if ( ++slab[SLAB_USED] == count )
+        partialDelete( slab, dir );
+
+    return (char *)slab + slabHeadSize( count ) +
+           ( (map - slab - SLAB_MAP)*64 + bit )*(cls + 1)*ALIGNMENT;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabClear
+// Description  : Mark a block in a slab as free in the bitmap of the slab
+//
+// Inputs       : slab - the head of the slab that holds the block
+//                addr - the address of the block
+// Outputs      : nothing
+static void slabClear( uint64_t *slab, char *addr )
+{
+    uint8_t cls = slab[SLAB_INFO] & 0xff; // The slab class
+    size_t count = ( slab[SLAB_INFO] >> 16 ) & 0xffff; // The number of objects
+    size_t index = ( addr - (char *)slab - slabHeadSize( count ) )/( (cls + 1)*ALIGNMENT ); // The object
+
+    slab[SLAB_MAP + index/64] &= ~( 1ull << (index % 64) );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabRelease
+// Description  : Count the blocks that have been cleared in a slab as free, put
+//                the slab back on the partial list if it was full, and give it
+//                back to the free lists if it becomes empty
+//
+// Inputs       : slab - the head of the slab
+//                freed - the number of blocks that have been cleared
+// Outputs      : nothing
+static void slabRelease( uint64_t *slab, size_t freed )
+{
+    size_t count = ( slab[SLAB_INFO] >> 16 ) & 0xffff; // The number of objects
+    uint64_t *dir = slabDirs[slabIndex( slab )]; // The directory of the slab
+
+    // Check the slab was full, so it is not on the partial list yet
+    if ( slab[SLAB_USED] == count )
+        partialAdd( slab, dir );
+    slab[SLAB_USED] -= freed;
+    dir[DIR_USED] -= freed;
+
+    // Check the slab becomes empty, and give its slot back to the directory and its
+    // block back to the free lists
+    if ( !slab[SLAB_USED] )
+    {
+        uint64_t *slot = (uint64_t *)slab[SLAB_SLOT]; // The slot of the slab
+
+        partialDelete( slab, dir );
+        *slot = dir[DIR_EMPTY] | 1;
+        dir[DIR_EMPTY] = (uint64_t)slot;
+        --dir[DIR_SLABS];
+        slabMark( slab, false );
+        heapLock();
+        blockDelete( slab );
+        heapUnlock();
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabDelete
+// Description  : Delete a block in a slab
+//
+// Inputs       : slab - the head of the slab that holds the block
+//                addr - the address of the block that needs to be deleted
+// Outputs      : nothing
+static void slabDelete( uint64_t *slab, char *addr )
+{
+    slabClear( slab, addr );
+    slabRelease( slab, 1 );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabSize
+// Description  : Get the object size of a slab
+//
+// Inputs       : slab - the head of the slab
+// Outputs      : the size of every object in the slab
+static size_t slabSize( uint64_t *slab )
+{
+    return ( (slab[SLAB_INFO] & 0xff) + 1 )*ALIGNMENT;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabRank
+// Description  : Make the slab classes with the most requests since the last
+//                ranking the hot ones, up to slabHotMax of them, and halve the
+//                requests so that the next ranking still remembers these
+//
+// Inputs       : nothing
+// Outputs      : nothing
+static void slabRank( void )
+{
+    uint64_t hot = 0; // The new hot classes
+    unsigned count = 0; // The number of new hot classes
+
+    // Pick the busiest class that is left, until there are enough or none is busy
+    while ( count < slabHotMax )
+    {
+        int best = -1; // The busiest class that is not hot yet
+
+        for ( int cls = 0; cls < SLAB_CLASSES; ++cls )
+        {
+            if ( !( hot >> cls & 1 ) && slabHits[cls] >= SLAB_DEMOTE &&
+                 ( best < 0 || slabHits[cls] > slabHits[best] ) )
+                best = cls;
+        }
+
+        // Check no class is busy enough
+        if ( best < 0 )
+            break;
+
+        hot |= 1ull << best;
+        ++count;
+    }
+
+    for ( int cls = 0; cls < SLAB_CLASSES; ++cls )
+        slabHits[cls] /= 2;
+
+    slabHot = hot;
+    slabHotCount = count;
+    slabWindow = SLAB_WINDOW;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabSample
+// Description  : Count a small request in its slab class, and tell whether it
+//                goes to the slabs: a hot class makes new slabs as it needs
+//                them, and a cold one only fills the slabs it still has. A cold
+//                class becomes hot as soon as it is busy enough, while there is
+//                room for it; the hot classes are ranked again every SLAB_WINDOW
+//                requests, which demotes the idle ones
+//
+// Inputs       : cls - the slab class of the request
+//                shortLived - whether the request goes to the slabs of short-lived objects
+// Outputs      : whether the request goes to the slabs
+static bool slabSample( uint8_t cls, bool shortLived )
+{
+    uint8_t index = cls + shortLived*SLAB_CLASSES; // The directory of the request
+
+    // Check the window is over, and rank the classes again
+    if ( !--slabWindow )
+        slabRank();
+
+    // Check the class is cold, busy enough and there is room for it
+    if ( ++slabHits[cls] >= SLAB_PROMOTE && !( slabHot >> cls & 1 ) && slabHotCount < slabHotMax )
+    {
+        slabHot |= 1ull << cls;
+        ++slabHotCount;
+    }
+    return ( slabHot >> cls & 1 ) || ( slabDirs[index] && slabDirs[index][DIR_PARTIAL] );
+}
+
+/*
+ * mm_set_slab_classes
+ * Sets the largest number of slab classes that are hot at once. It is kept
+ * across mm_init(), and takes effect at the next ranking.
+ */
+void mm_set_slab_classes( unsigned count )
+{
+    slabHotMax = count < SLAB_CLASSES ? count : SLAB_CLASSES;
+    return;
+}
+
+/*
+ * mm_set_policy
+ * Sets the placement policy of the free lists, one of MM_BEST_FIT,
+ * MM_FIRST_FIT, MM_NEXT_FIT, MM_ADDRESS_FIT and MM_GOOD_FIT. It is kept
+ * across mm_init(), and takes effect at the next one.
+ */
+void mm_set_policy( int next )
+{
+    policyNext = next >= 0 && next < MM_POLICIES ? next : MM_BEST_FIT;
+    return;
+}
+
+/*
+ * mm_set_backend
+ * Sets the backend of the payloads that are not in slabs, MM_SEGREGATED or
+ * MM_BUDDY. It is kept across mm_init(), and takes effect at the next one.
+ */
+void mm_set_backend( int next )
+{
+    backendNext = next == MM_BUDDY ? MM_BUDDY : MM_SEGREGATED;
+    return;
+}
+
+/*
+ * mm_set_lifetimes
+ * Sets whether short-lived payloads are kept apart from the long-lived ones.
+ * It is kept across mm_init(), and takes effect at the next one.
+ */
+void mm_set_lifetimes( bool segregate )
+{
+    lifetimesNext = segregate;
+    return;
+}
+
+/*
+ * Initialize: returns false on error, true on success.
+ */
+bool mm_init( void )
+{
+    /* IMPLEMENT THIS */
+    lists = mem_sbrk( ALIGNMENT/2*NUM_CLASSES );
+    nonEmpty = mem_sbrk( ALIGNMENT/2*MAP_WORDS );
+    listCounts = mem_sbrk( ALIGNMENT/2*NUM_CLASSES );
+    listBytes = mem_sbrk( ALIGNMENT/2*NUM_CLASSES );
+    blockAllocs = mem_sbrk( ALIGNMENT/2*NUM_CLASSES );
+    blockFrees = mem_sbrk( ALIGNMENT/2*NUM_CLASSES );
+    lifetimes = lifetimesNext;
+    slabDirCount = lifetimes ? SLAB_DIRS : SLAB_CLASSES;
+    slabDirs = mem_sbrk( ALIGNMENT/2*slabDirCount );
+    slabHits = mem_sbrk( ALIGNMENT/4*SLAB_CLASSES );
+    quickLists = mem_sbrk( ALIGNMENT/2*QUICK_CLASSES );
+    quickCounts = mem_sbrk( ALIGNMENT/2*QUICK_CLASSES );
+    backend = backendNext;
+
+    // Check the lifetimes are segregated, which need the tables of the samples,
+    // and all of them are long until the samples vote otherwise
+    if ( lifetimes )
+    {
+        lifetimeVotes = mem_sbrk( align( SLAB_MAX + 1 + NUM_CLASSES ) );
+        lifetimeSamples = mem_sbrk( ALIGNMENT*LIFETIME_SAMPLES );
+        for ( int i = 0; i < SLAB_MAX + 1 + NUM_CLASSES; ++i )
+            lifetimeVotes[i] = 0;
+        for ( int i = 0; i < 2*LIFETIME_SAMPLES; ++i )
+            lifetimeSamples[i] = 0;
+    }
+    lifetimeClock = 0;
+
+    // Check the blocks are buddies, and pad the tables so that the payload of a
+    // buddy block of a page starts a page. Buddies never look in front of the first one
+    if ( backend == MM_BUDDY )
+    {
+        buddyLists = mem_sbrk( ALIGNMENT/2*BUDDY_ORDERS );
+        uintptr_t page = 1ull << BUDDY_PAGE; // The size of a page
+        mem_sbrk( ( page - ( (uintptr_t)mem_heap_hi() + 1 + ALIGNMENT/2 ) % page ) % page );
+    }
+    else
+    {
+        // Pad the tables so that the payload of the first block is aligned, and put
+        // an allocated footer in front of the first block to stop coalescing there
+        mem_sbrk( ( ALIGNMENT - mem_heapsize() % ALIGNMENT ) % ALIGNMENT );
+        uint64_t prologue = 1; // The footer of an allocated empty block
+        mem_memcpy( mem_sbrk( ALIGNMENT/2 ), &prologue, sizeof(prologue) );
+    }
+    firstBlock = (char *)mem_heap_hi() + 1;
+
+    // Initialize the segregate free list
+    for ( int i = 0; i < NUM_CLASSES; ++i )
+    {
+        lists[i] = NULL;
+        listCounts[i] = 0;
+        listBytes[i] = 0;
+        blockAllocs[i] = 0;
+        blockFrees[i] = 0;
+    }
+
+    for ( int i = 0; i < MAP_WORDS; ++i )
+    {
+        nonEmpty[i] = 0;
+    }
+
+    // Initialize the quick lists
+    for ( int i = 0; i < QUICK_CLASSES; ++i )
+    {
+        quickLists[i] = NULL;
+        quickCounts[i] = 0;
+    }
+    quickTotal = 0;
+
+    // Initializa the slabs
+    for ( int i = 0; i < slabDirCount; ++i )
+        slabDirs[i] = NULL;
+    for ( int i = 0; i < SLAB_CLASSES; ++i )
+        slabHits[i] = 0;
+    slabHot = 0;
+    slabHotCount = 0;
+    slabWindow = SLAB_WINDOW;
+    slabPages = NULL;
+    slabPageWords = 0;
+    heapPage = (uintptr_t)mem_heap_lo() / SLAB_BYTES;
+    handleNodes = NULL;
+    handleEmpty = NULL;
+    // Initialize the buddies, whose bitmap is made as the heap grows
+    for ( int i = 0; backend == MM_BUDDY && i < BUDDY_ORDERS; ++i )
+        buddyLists[i] = NULL;
+    buddyOrders = 0;
+    buddyBase = firstBlock;
+    buddyMap = NULL;
+    buddyMapWords = 0;
+
+    extents = NULL;
+    extentDirty = 0;
+    purgeThreshold = RELEASE_MIN;
+    policy = policyNext;
+    rover = NULL;
+    roverClass = 0;
+    victim = NULL;
+    lastAlloc = true;
+    trimThreshold = TRIM_MIN;
+    trimmed = false;
+    trimTail = NULL;
+    zeroFrom = (char *)mem_heap_clean() > firstBlock ? (char *)mem_heap_clean() : firstBlock;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lifetimeSize
+// Description  : Get the entry of a payload size in the votes of the lifetimes:
+//                the size itself up to SLAB_MAX, and the class of its block above
+//
+// Inputs       : size - the size of the payload
+// Outputs      : the entry of the votes
+static size_t lifetimeSize( size_t size )
+{
+    // Check the size is small enough for the slabs
+    if ( size <= SLAB_MAX )
+        return size;
+
+    return SLAB_MAX + 1 + getIndex( blockSize( size ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lifetimeVote
+// Description  : Count the lifetime of a sampled payload in the votes of its size
+//
+// Inputs       : sample - the slot of the sample
+// Outputs      : nothing
+static void lifetimeVote( uint64_t *sample )
+{
+    int8_t *vote = &lifetimeVotes[sample[1] & 0xffff]; // The votes of the size of the sample
+
+    // Check the payload was freed soon, and vote short, or long otherwise
+    if ( lifetimeClock - ( sample[1] >> 16 ) < LIFETIME_SHORT )
+        *vote += *vote < LIFETIME_VOTES;
+    else
+        *vote -= *vote > -LIFETIME_VOTES;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lifetimeTrack
+// Description  : Count a malloc() call, and sample every LIFETIME_PERIOD-th
+//                payload in the slot of its address. A sample that is still there
+//                when another one takes its slot has lived long
+//
+// Inputs       : size - the size of the payload
+//                ptr - the payload
+// Outputs      : the payload
+static void *lifetimeTrack( size_t size, void *ptr )
+{
+    // Check the payload is not sampled
+    if ( ++lifetimeClock % LIFETIME_PERIOD )
+        return ptr;
+
+    uint64_t *sample = &lifetimeSamples[2*( (uintptr_t)ptr / ALIGNMENT % LIFETIME_SAMPLES )]; // The slot
+
+    // Check the slot holds an older sample that has lived long, and vote for it
+    if ( sample[0] && lifetimeClock - ( sample[1] >> 16 ) >= LIFETIME_SHORT )
+        lifetimeVote( sample );
+
+    sample[0] = (uint64_t)ptr;
+    sample[1] = lifetimeClock << 16 | lifetimeSize( size );
+    return ptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lifetimeFree
+// Description  : Count the lifetime of a payload that is freed, if it is sampled
+//
+// Inputs       : ptr - the payload
+// Outputs      : nothing
+static void lifetimeFree( void *ptr )
+{
+    uint64_t *sample = &lifetimeSamples[2*( (uintptr_t)ptr / ALIGNMENT % LIFETIME_SAMPLES )]; // The slot
+
+    // Check the payload is the sample of the slot
+    if ( sample[0] == (uint64_t)ptr )
+    {
+        lifetimeVote( sample );
+        sample[0] = 0;
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lifetimeAdd
+// Description  : Allocate a payload where the payloads of its expected lifetime
+//                go: the slabs of the short-lived or the long-lived objects of its
+//                class, or the back or the front of a free block
+//
+// Inputs       : size - the size of the payload
+//                shortLived - whether the payload is expected to be freed soon
+// Outputs      : the address of the payload
+static void *lifetimeAdd( size_t size, bool shortLived )
+{
+    // Check the size of the block is small enough for the slabs, and its class is hot
+    if ( size <= SLAB_MAX && slabSample( slabClass( size ), shortLived ) )
+        return slabAdd( size, shortLived );
+
+    ++blockAllocs[getIndex( blockSize( size ) )];
+    return blockPlace( size, shortLived );
+}
+
+/*
+ * malloc
+ */
+void *malloc( size_t size )
+{
+    /* IMPLEMENT THIS */
+    // Check the size of the block overflows
+    if ( size > SIZE_MAX/2 )
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Check the lifetimes are segregated, and guess the lifetime of the payload
+    // from the samples of its size
+    if ( lifetimes )
+        return lifetimeTrack( size, lifetimeAdd( size, lifetimeVotes[lifetimeSize( size )] > 0 ) );
+
+    return lifetimeAdd( size, false );
+}
+
+/*
+ * mm_malloc_hint
+ * Allocates a payload that is expected to be freed soon (MM_SHORT) or to live
+ * long (MM_LONG). Without one of the hints, or when the lifetimes are not
+ * segregated, it is malloc().
+ */
+void *mm_malloc_hint( size_t size, int hint )
+{
+    // Check the hint is not exactly one of the lifetimes, or the size of the block
+    // overflows, and let malloc() guess or fail
+    if ( !lifetimes || ( hint != MM_SHORT && hint != MM_LONG ) || size > SIZE_MAX/2 )
+        return malloc( size );
+
+    return lifetimeAdd( size, hint == MM_SHORT );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : markRealloc
+// Description  : Mark an allocated block as grown by realloc()
+//
+// Inputs       : block - the allocated block
+// Outputs      : nothing
+static void markRealloc( char *block )
+{
+    putHeader( block, getHeader( block ) | REALLOC_BIT );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockSplit
+// Description  : Allocate the front of a free block that has been taken off its
+//                list, and give the rest of it back to the segregate free lists
+//
+// Inputs       : block - the free block
+//                fullSize - the size of the free block
+//                newsize - the size of the allocated block
+// Outputs      : nothing
+static void blockSplit( char *block, size_t fullSize, size_t newsize )
+{
+    // Whether the block is an extent inside the heap whose pages were given back
+    bool released = fullSize >= EXTENT_MIN && in_heap( block + fullSize ) && ((uint64_t *)block)[EXTENT_AGE] >= 2;
+
+    addTags( block, 1, newsize );
+
+    // Check the block reaches into the memory known to be zero, which only the free
+    // tail of the heap does, and move the start of that memory past the block
+    if ( block + newsize > zeroFrom )
+        zeroFrom = block + newsize;
+
+    // Check there is no rest, so the next block follows an allocated block now
+    if ( fullSize == newsize )
+    {
+        setPrevAlloc( block + fullSize, true );
+        return;
+    }
+
+    addTags( block + newsize, 0, fullSize - newsize );
+    setPrevAlloc( block + newsize, true );
+
+    // Check the differences of the fullSize and the newsize is greater than or equal to 32
+    if ( fullSize - newsize >= 2*ALIGNMENT )
+    {
+        listAdd( block + newsize, getIndex( fullSize - newsize ) );
+
+        // Check the rest is below the tree, and make it the designated victim
+        if ( fullSize - newsize < 1 << TREE_EXP )
+            victim = block + newsize;
+    }
+
+    // Check the rest is an extent whose pages are given back already
+    if ( released && fullSize - newsize >= EXTENT_MIN )
+        ((uint64_t *)( block + newsize ))[EXTENT_AGE] = 2;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockSplitBack
+// Description  : Allocate the back of a free block that has been taken off its
+//                list for a short-lived payload, so the front stays in the free
+//                lists for the long-lived ones and the payload coalesces with it
+//                again once it is freed. The free tail of the heap, or a block
+//                whose front would be too small for a list, gives its front
+//
+// Inputs       : block - the free block
+//                fullSize - the size of the free block
+//                newsize - the size of the allocated block
+// Outputs      : the allocated block
+static char *blockSplitBack( char *block, size_t fullSize, size_t newsize )
+{
+    size_t rest = fullSize - newsize; // The size of the front that stays free
+
+    // Check the block is the free tail, or the front is too small for a list
+    if ( !in_heap( block + fullSize ) || rest < 2*ALIGNMENT )
+    {
+        blockSplit( block, fullSize, newsize );
+        return block;
+    }
+
+    // Whether the block is an extent whose pages were given back
+    bool released = fullSize >= EXTENT_MIN && ((uint64_t *)block)[EXTENT_AGE] >= 2;
+
+    addTags( block, 0, rest );
+    putHeader( block + rest, newsize << 3 | 1 );
+    setPrevAlloc( block + fullSize, true );
+    listAdd( block, getIndex( rest ) );
+
+    // Check the front is an extent whose pages are given back already
+    if ( released && rest >= EXTENT_MIN )
+        ((uint64_t *)block)[EXTENT_AGE] = 2;
+    return block + rest;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : heapLast
+// Description  : Take the free block at the end of the heap off its list, so that
+//                the heap can grow from it
+//
+// Inputs       : nothing
+// Outputs      : the free block at the end of the heap, or the end of the heap
+static char *heapLast( void )
+{
+    char *last = (char *)mem_heap_hi() + 1; // The end of the heap
+
+    // Check the last block is free
+    if ( !lastAlloc )
+    {
+        size_t size = getFooter( last ) >> 3; // The size of the last block
+        last -= size;
+
+        // Check the size of the last block is greater than 16
+        if ( size > ALIGNMENT )
+            listDelete( last, getIndex( size ) );
+    }
+    return last;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : heapGrow
+// Description  : Grow the heap so that the free space from a block to the end of
+//                the heap is at least a size, by at least HEAP_CHUNK bytes at a
+//                time, and make the whole space one free block
+//
+// Inputs       : block - the result of heapLast()
+//                size - the size the free space needs
+// Outputs      : the size of the free block, which is not in the free lists, or 0
+//                if the heap cannot grow, and the block is back in its list
+static size_t heapGrow( char *block, size_t size )
+{
+    char *end = (char *)mem_heap_hi() + 1; // The end of the heap
+    bool fresh = block == end; // Whether the block does not have a header yet
+
+    // Check the free space is too small
+    if ( size > (size_t)( end - block ) )
+    {
+        size_t grow = size - ( end - block ); // The size to grow the heap by
+
+        // Check the growth is smaller than a chunk
+        if ( grow < HEAP_CHUNK )
+            grow = HEAP_CHUNK;
+
+        // Check the heap cannot grow, and give the free tail back to its list
+        if ( mem_sbrk( grow ) == (void *)-1 )
+        {
+            if ( !fresh && end - block > ALIGNMENT )
+                listAdd( block, getIndex( end - block ) );
+            return 0;
+        }
+
+        // Check the heap was trimmed too eagerly, so trim it less often from now on
+        if ( trimmed && trimThreshold < TRIM_MAX )
+            trimThreshold *= 2;
+        trimmed = false;
+
+        // Check the block is not new, so its old footer is left in the middle of it
+        if ( !fresh )
+            dropFooter( end );
+        end += grow;
+    }
+
+    // Check the block is new, so it follows the allocated last block
+    if ( fresh )
+        putHeader( block, PREV_ALLOC );
+
+    addTags( block, 0, end - block );
+    lastAlloc = false;
+    return end - block;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : heapTrim
+// Description  : Shrink the heap so that only TRIM_KEEP bytes of its free tail
+//                are left, and give the pages past the new end back
+//
+// Inputs       : block - the free tail of the heap, which is not in the free lists
+//                size - the size of the free tail, greater than TRIM_KEEP
+// Outputs      : the size of the free tail that is left, without its tags
+static size_t heapTrim( char *block, size_t size )
+{
+    dropFooter( block + size );
+    mem_trim( size - TRIM_KEEP );
+
+    // Check the pages given back start below zeroFrom
+    if ( (char *)mem_heap_clean() < zeroFrom )
+        zeroFrom = mem_heap_clean();
+    return TRIM_KEEP;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tailTrim
+// Description  : Trim the free tail of the heap down to TRIM_KEEP bytes, whatever
+//                the threshold, and put the rest of it back into the free lists
+//
+// Inputs       : nothing
+// Outputs      : nothing
+static void tailTrim( void )
+{
+    char *end = (char *)mem_heap_hi() + 1; // The end of the heap
+    char *block = heapLast(); // The free tail of the heap
+    size_t size = end - block; // The size of the free tail
+
+    // Check the free tail is more than is kept
+    if ( size > TRIM_KEEP )
+        size = heapTrim( block, size );
+
+    // Check there is a free tail, and put it back
+    if ( size )
+    {
+        addTags( block, 0, size );
+
+        // Check the size of the block is greater than 16
+        if ( size > ALIGNMENT )
+            listAdd( block, getIndex( size ) );
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : quickTake
+// Description  : Take the last block freed into a quick list, which is still
+//                marked allocated
+//
+// Inputs       : index - the quick list
+// Outputs      : the block
+static char *quickTake( size_t index )
+{
+    char *block = quickLists[index]; // The block at the front of the list
+    quickLists[index] = *(char **)( block + ALIGNMENT/2 );
+    --quickCounts[index];
+    --quickTotal;
+    putHeader( block, getHeader( block ) & ~(uint64_t)REALLOC_BIT );
+    return block;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : quickFlush
+// Description  : Coalesce every block of the quick lists into the segregate free
+//                lists
+//
+// Inputs       : nothing
+// Outputs      : whether there was a block to coalesce
+static bool quickFlush( void )
+{
+    // Check the quick lists are empty
+    if ( !quickTotal )
+        return false;
+
+    for ( size_t i = 0; i < QUICK_CLASSES; ++i )
+    {
+        while ( quickLists[i] )
+            blockDelete( quickTake( i ) + ALIGNMENT/2 );
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyOrder
+// Description  : Calculate the order of the smallest buddy block that holds a
+//                payload with its header
+//
+// Inputs       : size - the size of the payload
+// Outputs      : the order of the block, or BUDDY_ORDERS if the heap cannot hold it
+static unsigned buddyOrder( size_t size )
+{
+    // Check the payload is larger than the heap
+    if ( size >= ( 1ull << ( BUDDY_ORDERS - 1 ) ) )
+        return BUDDY_ORDERS;
+
+    unsigned order = 64 - __builtin_clzll( size + ALIGNMENT/2 - 1 ); // The order that fits
+
+    return order > BUDDY_MIN ? order : BUDDY_MIN;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyIsFree
+// Description  : Tell whether a free buddy block of an order starts at an
+//                address. The buddy of a block always starts a block, so the
+//                header tells; the bitmap of free buddies tells first, without
+//                touching the block, where it covers the heap
+//
+// Inputs       : block - the address of the block
+//                order - the order of the block
+// Outputs      : whether the block is free and of that order
+static bool buddyIsFree( char *block, unsigned order )
+{
+    size_t unit = (size_t)( block - buddyBase ) >> BUDDY_MIN; // The unit of the block
+
+    // Check the bitmap covers the block, and says it is allocated
+    if ( unit/64 < buddyMapWords && !( buddyMap[unit/64] >> (unit % 64) & 1 ) )
+        return false;
+
+    return getHeader( block ) == ( 1ull << order ) << 3;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyMark
+// Description  : Mark or unmark the start of a free buddy block in the bitmap
+//                of free buddies
+//
+// Inputs       : block - the address of the block
+//                isFree - whether the block is free from now on
+// Outputs      : nothing
+static void buddyMark( char *block, bool isFree )
+{
+    size_t unit = (size_t)( block - buddyBase ) >> BUDDY_MIN; // The unit of the block
+
+    // Check the bitmap covers the block
+    if ( unit/64 >= buddyMapWords )
+        return;
+
+    if ( isFree )
+        buddyMap[unit/64] |= 1ull << (unit % 64);
+    else
+        buddyMap[unit/64] &= ~( 1ull << (unit % 64) );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyPush
+// Description  : Make a buddy block free, and add it to the front of the list
+//                of its order
+//
+// Inputs       : block - the address of the block
+//                order - the order of the block
+// Outputs      : nothing
+static void buddyPush( char *block, unsigned order )
+{
+    size_t size = 1ull << order; // The size of the block
+    uint8_t index = getIndex( size ); // The class the block is counted in
+
+    putHeader( block, size << 3 );
+    setPred( block, NULL );
+    setSucc( block, buddyLists[order] );
+
+    // Check the list is not empty
+    if ( buddyLists[order] )
+        setPred( buddyLists[order], block );
+    buddyLists[order] = block;
+    buddyOrders |= 1ull << order;
+    buddyMark( block, true );
+    ++listCounts[index];
+    listBytes[index] += size;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyUnlink
+// Description  : Take a free buddy block off the list of its order
+//
+// Inputs       : block - the address of the block
+//                order - the order of the block
+// Outputs      : nothing
+static void buddyUnlink( char *block, unsigned order )
+{
+    char *pred = getPred( block ); // The predecessor of the block
+    char *succ = getSucc( block ); // The successor of the block
+    uint8_t index = getIndex( 1ull << order ); // The class the block is counted in
+
+    // Check the block is the first one
+    if ( !pred )
+    {
+        buddyLists[order] = succ;
+
+        // Check the list becomes empty
+        if ( !succ )
+            buddyOrders &= ~( 1ull << order );
+    }
+    else
+    {
+        setSucc( pred, succ );
+    }
+
+    // Check the block is not the last one
+    if ( succ )
+        setPred( succ, pred );
+    buddyMark( block, false );
+    --listCounts[index];
+    listBytes[index] -= 1ull << order;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyRelease
+// Description  : Free a buddy block, and merge it with its buddy as long as the
+//                buddy is free and of the same order, one order at a time. The
+//                pages of a large merged block are given back to the system
+//
+// Inputs       : block - the address of the block
+//                order - the order of the block
+// Outputs      : nothing
+static void buddyRelease( char *block, unsigned order )
+{
+    char *end = (char *)mem_heap_hi() + 1; // The end of the heap
+
+    // Merge with the buddy while it is free; the buddy of the block is the one
+    // whose offset differs in the bit of its order
+    for ( ; order + 1 < BUDDY_ORDERS; ++order )
+    {
+        char *buddy = buddyBase + ( (size_t)( block - buddyBase ) ^ ( 1ull << order ) ); // The buddy
+
+        // Check the buddy is past the heap, or it is not free as a whole
+        if ( buddy >= end || !buddyIsFree( buddy, order ) )
+            break;
+
+        buddyUnlink( buddy, order );
+        if ( buddy < block )
+            block = buddy;
+    }
+    buddyPush( block, order );
+
+    // Check the block is large enough to give its pages back, past its links
+    if ( ( 1ull << order ) >= RELEASE_MIN )
+        mem_release( block + 3*ALIGNMENT/2, ( 1ull << order ) - 3*ALIGNMENT/2 );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddySpan
+// Description  : Free the memory between two offsets of the buddy blocks, as the
+//                largest aligned blocks that fit in it
+//
+// Inputs       : from - the offset of the start
+//                to - the offset of the end
+// Outputs      : nothing
+static void buddySpan( size_t from, size_t to )
+{
+    while ( from < to )
+    {
+        unsigned order = from ? __builtin_ctzll( from ) : BUDDY_ORDERS - 1; // The alignment of the start
+
+        // Shrink the block until it fits
+        while ( from + ( 1ull << order ) > to )
+            --order;
+
+        buddyRelease( buddyBase + from, order );
+        from += 1ull << order;
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyGrow
+// Description  : Grow the heap by a free buddy block of an order, after the
+//                free blocks that align it. When the bitmap of free buddies
+//                would not cover the heap, a new one twice as large is put at
+//                the end of the heap, and the old one is freed, until it covers
+//                2^BUDDY_MAP_MAX bytes
+//
+// Inputs       : order - the order of the block
+// Outputs      : whether the heap could grow
+static bool buddyGrow( unsigned order )
+{
+    size_t size = 1ull << order; // The size of the block
+    size_t from = (char *)mem_heap_hi() + 1 - buddyBase; // The end of the buddy blocks
+    size_t to = ( ( from + size - 1 ) & ~( size - 1 ) ) + size; // The end of the new block
+    size_t end = to; // The new end of the buddy blocks
+    size_t words = buddyMapWords; // The number of words of the bitmap
+    size_t mapSize = 0; // The size of the block of a new bitmap
+
+    // Check the bitmap does not cover the new block, and make room for a new one
+    if ( ( to >> BUDDY_MIN ) > words*64 && words*64 < 1ull << ( BUDDY_MAP_MAX - BUDDY_MIN ) )
+    {
+        words = 2*( to >> BUDDY_MIN )/64 + 1;
+        if ( words > 1ull << ( BUDDY_MAP_MAX - BUDDY_MIN - 6 ) )
+            words = 1ull << ( BUDDY_MAP_MAX - BUDDY_MIN - 6 );
+        mapSize = 1ull << buddyOrder( words*sizeof(uint64_t) );
+        end = ( ( to + mapSize - 1 ) & ~( mapSize - 1 ) ) + mapSize;
+    }
+
+    // Check the heap is out of memory
+    if ( mem_sbrk( end - from ) == (void *)-1 )
+        return false;
+
+    // Check there is a new bitmap, clear it where the memory of the end of the heap
+    // has been used before, and mark the free blocks in it
+    if ( mapSize )
+    {
+        char *block = buddyBase + end - mapSize; // The block of the new bitmap
+        uint64_t *map = (uint64_t *)( block + ALIGNMENT/2 ); // The new bitmap
+        uint64_t *old = buddyMap; // The old bitmap
+
+        size_t dirty = words*sizeof(uint64_t); // The bytes of the bitmap that may not be zero
+
+        // Check the bitmap ends in memory known to be zero
+        if ( (char *)map + dirty > zeroFrom )
+            dirty = zeroFrom > (char *)map ? (size_t)( zeroFrom - (char *)map ) : 0;
+        putHeader( block, mapSize << 3 | 1 );
+        memset( map, 0, dirty );
+        buddyMap = map;
+        buddyMapWords = words;
+
+        for ( int order = BUDDY_MIN; order < BUDDY_ORDERS; ++order )
+        {
+            for ( char *ptr = buddyLists[order]; ptr; ptr = getSucc( ptr ) )
+                buddyMark( ptr, true );
+        }
+
+        // Check there was an old bitmap, and free its block
+        if ( old )
+            buddyRelease( (char *)old - ALIGNMENT/2, __builtin_ctzll( getHeader( (char *)old - ALIGNMENT/2 ) >> 3 ) );
+        buddySpan( to, end - mapSize );
+    }
+    buddySpan( from, to );
+
+    // Check the end of the heap is fresh memory now
+    if ( zeroFrom < buddyBase + end )
+        zeroFrom = buddyBase + end;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyTake
+// Description  : Take a buddy block of an order, splitting the smallest free
+//                block that is large enough and freeing the upper halves, or
+//                growing the heap when there is none
+//
+// Inputs       : order - the order of the block
+// Outputs      : the allocated block, or NULL if the heap is out of memory
+static char *buddyTake( unsigned order )
+{
+    // Check the block is larger than the heap
+    if ( order >= BUDDY_ORDERS )
+        return NULL;
+
+    // Grow the heap until a free block is large enough
+    while ( !( buddyOrders >> order ) )
+    {
+        if ( !buddyGrow( order ) )
+            return NULL;
+    }
+
+    unsigned from = __builtin_ctzll( buddyOrders >> order ) + order; // The smallest order that is free
+    char *block = buddyLists[from]; // The block to split
+    buddyUnlink( block, from );
+
+    // Split the block in halves, and free the upper one until the order fits
+    while ( from > order )
+    {
+        --from;
+        buddyPush( block + ( 1ull << from ), from );
+    }
+    putHeader( block, ( 1ull << order ) << 3 | 1 );
+    return block;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyAdd
+// Description  : Allocate a payload in a buddy block
+//
+// Inputs       : size - the size of the payload
+// Outputs      : the address of the payload, or NULL if the heap is out of memory
+static void *buddyAdd( size_t size )
+{
+    char *block = buddyTake( buddyOrder( size ) ); // The block
+
+    return block ? block + ALIGNMENT/2 : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyAlign
+// Description  : Allocate an aligned payload in a buddy block. The payload of a
+//                block of order BUDDY_PAGE or more starts a page, so a block as
+//                large as the alignment is aligned
+//
+// Inputs       : size - the size of the payload
+//                alignment - the alignment, a power of two
+// Outputs      : the address of the payload, or NULL if the alignment is larger than a page
+static void *buddyAlign( size_t size, size_t alignment )
+{
+    unsigned order = buddyOrder( size ); // The order of the block
+
+    // Check the alignment is larger than a page, which no payload is aligned to
+    if ( alignment > 1ull << BUDDY_PAGE )
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Check the block is smaller than the alignment
+    if ( 1ull << order < alignment )
+        order = __builtin_ctzll( alignment );
+
+    char *block = buddyTake( order ); // The block
+    return block ? block + ALIGNMENT/2 : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyDelete
+// Description  : Free the buddy block of a payload
+//
+// Inputs       : ptr - the address of the payload
+// Outputs      : nothing
+static void buddyDelete( void *ptr )
+{
+    char *block = (char *)ptr - ALIGNMENT/2; // The block of the payload
+    uint64_t header = getHeader( block ); // The header of the block
+
+    // Check the block is free already
+    if ( !(header & 1) )
+        return;
+
+    buddyRelease( block, __builtin_ctzll( header >> 3 ) );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyRealloc
+// Description  : Resize the buddy block of a payload. A smaller order frees the
+//                upper halves in place; a larger one takes in the free buddies
+//                above the block while it is their lower half, or grows the heap
+//                when the block is the last one. Only otherwise the payload moves
+//
+// Inputs       : oldptr - the address of the old payload
+//                size - the new size of the payload
+// Outputs      : the address of the payload, or NULL if the heap is out of memory
+static void *buddyRealloc( void *oldptr, size_t size )
+{
+    char *block = (char *)oldptr - ALIGNMENT/2; // The block of the old payload
+    uint64_t header = getHeader( block ); // The header of the old block
+
+    // Check the old block is allocated
+    if ( !(header & 1) )
+        return NULL;
+
+    unsigned order = __builtin_ctzll( header >> 3 ); // The order of the old block
+    unsigned newOrder = buddyOrder( size ); // The order of the new block
+    size_t offset = block - buddyBase; // The offset of the block
+
+    // Check the block shrinks, and free its upper halves
+    if ( newOrder <= order )
+    {
+        while ( order > newOrder )
+        {
+            --order;
+            buddyPush( block + ( 1ull << order ), order );
+        }
+        putHeader( block, ( 1ull << order ) << 3 | 1 );
+        return oldptr;
+    }
+
+    char *end = (char *)mem_heap_hi() + 1; // The end of the heap
+    unsigned top = order; // The order the block can grow to in place
+
+    // Climb while the block is the lower half and its buddy is free
+    while ( top < newOrder && !( offset >> top & 1 ) && block + ( 1ull << top ) < end &&
+            buddyIsFree( block + ( 1ull << top ), top ) )
+        ++top;
+
+    // Check the block is the last one and aligned to the new order, so the heap can
+    // grow under it
+    bool last = top < newOrder && block + ( 1ull << top ) == end && !( offset & ( ( 1ull << newOrder ) - 1 ) );
+
+    // Check the block can grow in place
+    if ( top == newOrder || last )
+    {
+        // Check the heap has to be extended
+        if ( last && mem_sbrk( block + ( 1ull << newOrder ) - end ) == (void *)-1 )
+            return NULL;
+
+        for ( unsigned i = order; i < top; ++i )
+            buddyUnlink( block + ( 1ull << i ), i );
+        putHeader( block, ( 1ull << newOrder ) << 3 | 1 );
+
+        // Check the end of the heap is fresh memory now
+        if ( zeroFrom < (char *)mem_heap_hi() + 1 )
+            zeroFrom = (char *)mem_heap_hi() + 1;
+        return oldptr;
+    }
+
+    // Otherwise move the payload with a single copy
+    char *ptr = malloc( size );
+    if ( !ptr )
+        return NULL;
+    mem_memcpy( ptr, oldptr, ( 1ull << order ) - ALIGNMENT/2 );
+    ++blockFrees[getIndex( 1ull << order )];
+    buddyRelease( block, order );
+    return ptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockFree
+// Description  : Free a block for the user. A small block waits in the quick
+//                list of its size without being coalesced, so that the next
+//                request of that size takes it back for free; the list is
+//                coalesced when it is full
+//
+// Inputs       : ptr - the address of the payload
+// Outputs      : nothing
+static void blockFree( void *ptr )
+{
+    char *block = (char *)ptr - ALIGNMENT/2; // The block of the payload
+    uint64_t header = getHeader( block ); // The header of the block
+    size_t size = header >> 3; // The size of the block
+
+    // Check the block is free already
+    if ( !(header & 1) )
+        return;
+    ++blockFrees[getIndex( size )];
+
+    // Check the block is small enough for the quick lists, which buddies do not use
+    if ( size <= QUICK_BYTES && backend != MM_BUDDY )
+    {
+        size_t index = size/ALIGNMENT - 1; // The quick list of the block
+
+        // Check the quick list is full, and coalesce it first
+        if ( quickCounts[index] == QUICK_BOUND )
+        {
+            while ( quickLists[index] )
+                blockDelete( quickTake( index ) + ALIGNMENT/2 );
+        }
+
+        *(char **)ptr = quickLists[index];
+        quickLists[index] = block;
+        ++quickCounts[index];
+        ++quickTotal;
+        return;
+    }
+    blockDelete( ptr );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listFirst
+// Description  : Find the first block that fits in a stretch of a free list
+//
+// Inputs       : ptr - the first block to look at
+//                end - the block to stop at, or NULL for the end of the list
+//                newsize - the size of the block
+// Outputs      : the first block that is big enough, or NULL if there is none
+static char *listFirst( char *ptr, char *end, size_t newsize )
+{
+    // Loop through the stretch until a block is big enough
+    for ( ; ptr != end; ptr = getSucc( ptr ) )
+    {
+        if ( ( getHeader( ptr ) >> 3 ) >= newsize )
+            return ptr;
+    }
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listBest
+// Description  : Find the best fit among the first blocks that fit in a free list
+//
+// Inputs       : ptr - the first block of the list
+//                newsize - the size of the block
+//                depth - the number of fitting blocks to compare
+// Outputs      : the smallest of them, or NULL if no block is big enough
+static char *listBest( char *ptr, size_t newsize, unsigned depth )
+{
+    uint64_t difference = (1ull*(1ull<<40)); // The difference of the size
+    char *best = NULL; // The pointer to save the best block
+
+    // Check the pointer is not null
+    while ( ptr )
+    {
+        size_t size = getHeader( ptr ) >> 3; // the size of the block that the pointer points to 
+
+        // Chenck the size is greater than the new size
+        if ( size >= newsize )
+        {
+            // Check the difference of the sizes is less than the difference that recorded before
+            if ( size - newsize < difference )
+            {
+                difference = size - newsize;
+                best = ptr;
+            }
+
+            // Check the difference is 0, or enough blocks are compared
+            if ( !difference || !--depth )
+                break;
+        }
+        ptr = getSucc( ptr );
+    }
+    return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockFit
+// Description  : Take a fit for a block off the segregate free lists, placed by
+//                the policy that mm_init() chose. The tree of large free blocks
+//                always gives the best fit, the lowest of that size
+//
+// Inputs       : newsize - the size of the block
+//                fullSize - where to save the size of the free block
+// Outputs      : the free block, or NULL if no free block is big enough
+static char *blockFit( size_t newsize, size_t *fullSize )
+{
+    uint8_t index = getIndex( newsize ); // The index of the block in segregate free list
+
+    // Look for a fit in the list of the block's own class first. If there is
+    // none, jump to the first non-empty class above it, where every block fits
+    for ( int i = index; i >= 0; i = findClass( i + 1 ) )
+    {
+        char *best = NULL; // The block that is taken
+
+        // Check the own class has no fit, and take the designated victim before a
+        // larger block, unless the policy places blocks by their order or address
+        if ( i != index && ( policy == MM_BEST_FIT || policy == MM_GOOD_FIT ) &&
+             ( best = victimFit( newsize, fullSize ) ) )
+            return best;
+
+        // Check the class is the tree, which finds the best fit by itself, or the
+        // lowest extent that fits for a large block with address-ordered first fit
+        if ( i == TREE_CLASS )
+        {
+            best = policy == MM_ADDRESS_FIT && newsize >= EXTENT_MIN ? extentFit( newsize ) : NULL;
+            if ( !best )
+                best = treeFit( lists[i], newsize );
+        }
+        else if ( policy == MM_NEXT_FIT )
+        {
+            // Start from the rover if it is in this list, and wrap around
+            char *start = roverClass == i && rover ? rover : lists[i]; // The first block to look at
+            best = listFirst( start, NULL, newsize );
+            if ( !best && start != lists[i] )
+                best = listFirst( lists[i], start, newsize );
+
+            // Check a block fits, and look at the one behind it next time
+            if ( best )
+            {
+                rover = getSucc( best );
+                roverClass = i;
+            }
+        }
+        else if ( policy == MM_FIRST_FIT || policy == MM_ADDRESS_FIT )
+        {
+            best = listFirst( lists[i], NULL, newsize );
+        }
+        else
+        {
+            best = listBest( lists[i], newsize, policy == MM_GOOD_FIT ? GOOD_DEPTH : ~0u );
+        }
+
+        // Check the best pointer is not null
+        if ( best )
+        {
+            listDelete( best, i );
+            *fullSize = getHeader( best ) >> 3;
+            return best;
+        }
+    }
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : victimFit
+// Description  : Take the designated victim off its list if it is large enough,
+//                so that runs of requests are carved one after another from the
+//                block that the last split left
+//
+// Inputs       : newsize - the size of the block
+//                fullSize - where to save the size of the free block
+// Outputs      : the designated victim, or NULL if it does not fit
+static char *victimFit( size_t newsize, size_t *fullSize )
+{
+    // Check there is no designated victim
+    if ( !victim )
+        return NULL;
+
+    size_t size = getHeader( victim ) >> 3; // The size of the designated victim
+
+    // Check the designated victim is too small
+    if ( size < newsize )
+        return NULL;
+
+    char *block = victim; // The designated victim, forgotten by listDelete()
+    listDelete( block, getIndex( size ) );
+    *fullSize = size;
+    return block;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockPlace
+// Description  : Allocate a block with a header and a footer from the segregate
+//                free lists, or from the end of the heap, at the front of the free
+//                block or at its back for a short-lived payload. Then trim the free
+//                tail that the request passed by, and purge the extents when due
+//
+// Inputs       : size - the size of the payload
+//                shortLived - whether the payload is expected to be freed soon
+// Outputs      : the address of the payload
+static void *blockPlace( size_t size, bool shortLived )
+{
+    // Check the blocks are buddies
+    if ( backend == MM_BUDDY )
+        return buddyAdd( size );
+
+    size_t newsize = blockSize( size ); // The size of the block
+
+    // Check a block of the same size is waiting in its quick list, and reuse it
+    // as it is
+    if ( newsize <= QUICK_BYTES && quickLists[newsize/ALIGNMENT - 1] )
+        return quickTake( newsize/ALIGNMENT - 1 ) + ALIGNMENT/2;
+
+    size_t fullSize = 0; // The size of the free block
+    char *ptr = blockFit( newsize, &fullSize ); // The free block
+
+    // Check no free block fits, and coalesce the quick lists before giving up
+    if ( !ptr && quickFlush() )
+        ptr = blockFit( newsize, &fullSize );
+
+    // Check no free block fits, and grow the heap
+    if ( !ptr )
+    {
+        ptr = heapLast();
+        fullSize = heapGrow( ptr, newsize );
+
+        // Check there is no memory left
+        if ( !fullSize )
+            return NULL;
+    }
+
+    // Check the payload is short-lived, and take the back of the block
+    if ( shortLived )
+        ptr = blockSplitBack( ptr, fullSize, newsize );
+    else
+        blockSplit( ptr, fullSize, newsize );
+
+    // Check the free tail waiting for its trim was passed by, so it stayed free across
+    // a request, and trim it now
+    if ( trimTail )
+    {
+        tailTrim();
+        trimmed = true;
+    }
+
+    // Check purgeThreshold bytes have been freed into the extents, and purge them and
+    // wait twice as long for the next purge, so an extent has to stay free across two
+    // requests before its pages are given back
+    if ( extentDirty >= purgeThreshold )
+    {
+        extentPurge( extents );
+        if ( purgeThreshold < TRIM_MAX )
+            purgeThreshold *= 2;
+        if ( purgeThreshold < extentDirty )
+            purgeThreshold = extentDirty;
+        extentDirty = 0;
+    }
+    return ptr + ALIGNMENT/2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockAdd
+// Description  : Allocate a block with a header and a footer from the segregate
+//                free lists, or from the end of the heap
+//
+// Inputs       : size - the size of the payload
+// Outputs      : the address of the payload
+static void *blockAdd( size_t size )
+{
+    return blockPlace( size, false );
+}
+
+/*
+ * free
+ */
+void free( void *ptr )
+{
+    /* IMPLEMENT THIS */
+    // Check the pointer is not null
+    if ( !ptr )
+        return;
+
+    // Check the lifetimes are segregated, and measure the payload if it is sampled
+    if ( lifetimes )
+        lifetimeFree( ptr );
+
+    uint64_t *slab = slabFind( ptr ); // The slab that holds the block
+
+    // Check the block is in a slab
+    if ( slab )
+    {
+        slabDelete( slab, ptr );
+        return;
+    }
+
+    blockFree( ptr );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockDelete
+// Description  : Free a block with a header, give it a footer, coalesce it with
+//                the free blocks next to it, and add it into the segregate free lists.
+//                A large free tail of the heap waits to be trimmed, and a large freed
+//                block counts towards the next purge of the extents
+//
+// Inputs       : ptr - the address of the payload
+// Outputs      : nothing
+static void blockDelete( void *ptr )
+{
+    char *block = (char *)ptr - ALIGNMENT/2; // The block that ptr points to
+    uint64_t header = getHeader( block ); // The header of the block
+    size_t size = header >> 3; // The size of the block
+    size_t freedSize = size; // The size of the freed block
+
+    // Check the blocks are buddies, which merge with their buddies instead
+    if ( backend == MM_BUDDY )
+    {
+        buddyDelete( ptr );
+        return;
+    }
+
+    // Check the ptr is free
+    if ( !(header & 1) )
+        return;
+
+    // Check the previous block is free, so it has a footer in front of the block,
+    // and coalesce with it
+    if ( !(header & PREV_ALLOC) )
+    {
+        size_t preSize = getFooter( block ) >> 3; // The size of the previous block
+        block -= preSize;
+        size += preSize;
+
+        // Check the size of the previous block is greater than 16
+        if ( preSize > ALIGNMENT )
+            listDelete( block, getIndex(preSize) );
+    }
+
+    char *post = block + size; // The post block
+
+    // Check the post block is in heap and free, and coalesce with it
+    if ( in_heap( post ) && !(getHeader( post ) & 1) )
+    {
+        size_t postSize = getHeader( post ) >> 3; // The size of the post block
+        size += postSize;
+
+        // Check the size of the post block is greater than 16
+        if ( postSize > ALIGNMENT )
+            listDelete( post, getIndex(postSize) );
+        dropTags( post, postSize );
+    }
+
+    // Check the block is a large free tail of the heap, which waits for a block request
+    // to pass it by before it is trimmed
+    if ( !in_heap( block + size ) && size >= trimThreshold )
+        trimTail = block;
+
+    addTags( block, 0, size );
+
+    // Check the size of the block is greater than 16
+    if ( size > ALIGNMENT )
+        listAdd( block, getIndex(size) );
+    setPrevAlloc( block + size, false );
+
+    // Check the block is an extent, whose bytes count towards the next purge
+    if ( size >= EXTENT_MIN )
+        extentDirty += freedSize;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : alignStart
+// Description  : Find the first block start at or after an address whose payload
+//                is aligned, leaving either no gap or a gap that can be a free block
+//
+// Inputs       : addr - the lowest start of the block
+//                alignment - the alignment of the payload, a power of two
+// Outputs      : the start of the block
+static char *alignStart( char *addr, size_t alignment )
+{
+    uintptr_t payload = (uintptr_t)addr + ALIGNMENT/2; // The payload without a gap
+    uintptr_t aligned = ( payload + alignment - 1 ) & ~(uintptr_t)( alignment - 1 ); // The aligned payload
+
+    // Check the gap is too small to be a free block
+    if ( aligned != payload && aligned - payload < 2*ALIGNMENT )
+        aligned += alignment;
+
+    return (char *)aligned - ALIGNMENT/2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : treeAlign
+// Description  : Find the smallest block in a subtree of the tree that has room
+//                for an aligned block
+//
+// Inputs       : node - the root of the subtree
+//                size - the size of the block
+//                alignment - the alignment of the payload, a power of two
+// Outputs      : the block, or null if no block has room
+static char *treeAlign( char *node, size_t size, size_t alignment )
+{
+    // Check the subtree is empty
+    if ( !node )
+        return NULL;
+
+    size_t nodeSize = getHeader( node ) >> 3; // The size of the block
+
+    // Check the block is too small, so only the right subtree can have room
+    if ( nodeSize < size )
+        return treeAlign( *treeRight( node ), size, alignment );
+
+    char *fit = treeAlign( *treeLeft( node ), size, alignment ); // The fit among the smaller blocks
+
+    // Check there is no smaller fit, and the block itself has room
+    if ( !fit && alignStart( node, alignment ) + size <= node + nodeSize )
+        fit = node;
+
+    // Check there is still no fit
+    if ( !fit )
+        fit = treeAlign( *treeRight( node ), size, alignment );
+    return fit;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockAlign
+// Description  : Allocate a block with a header and a footer whose payload starts
+//                at a multiple of an alignment. The free space in front of the
+//                block goes back to the segregate free lists
+//
+// Inputs       : size - the size of the payload
+//                alignment - the alignment of the payload, a power of two
+// Outputs      : the address of the payload
+static void *blockAlign( size_t size, size_t alignment )
+{
+    // Check the blocks are buddies, which are aligned by their order
+    if ( backend == MM_BUDDY )
+        return buddyAlign( size, alignment );
+
+    size_t newsize = blockSize( size ); // The size of the block
+
+    // Loop through the non-empty lists and take the first block with room for the
+    // aligned block
+    for ( int i = findClass( getIndex( newsize ) ); i >= 0; i = findClass( i + 1 ) )
+    {
+        char *ptr = lists[i];
+
+        // Check the class is the tree, which finds the first fit by itself
+        if ( i == TREE_CLASS )
+            ptr = treeAlign( ptr, newsize, alignment );
+
+        // Check the pointer is not null
+        while ( ptr )
+        {
+            size_t size = getHeader( ptr ) >> 3; // the size of the block that the pointer points to
+            char *succ = i == TREE_CLASS ? NULL : getSucc( ptr ); // the successor of the block that the pointer points to
+
+            char *start = alignStart( ptr, alignment ); // The start of the aligned block
+
+            // Check the aligned block fits in the free block
+            if ( start + newsize <= ptr + size )
+            {
+                listDelete( ptr, i );
+
+                // Check there is a gap in front of the aligned block
+                if ( start > ptr )
+                {
+                    addTags( ptr, 0, start - ptr );
+                    listAdd( ptr, getIndex( start - ptr ) );
+                    setPrevAlloc( start, false );
+                }
+                blockSplit( start, ptr + size - start, newsize );
+                return start + ALIGNMENT/2;
+            }
+            ptr = succ;
+        }
+    }
+
+    // Check the quick lists hold blocks, and coalesce them before the heap grows
+    if ( quickFlush() )
+        return blockAlign( size, alignment );
+
+    char *last = heapLast(); // The free space at the end of the heap
+    char *start = alignStart( last, alignment ); // The start of the aligned block
+    size_t fullSize = heapGrow( last, start - last + newsize ); // The size of the free space
+
+    // Check there is no memory left
+    if ( !fullSize )
+        return NULL;
+
+    // Check there is a gap in front of the aligned block, and free it
+    if ( start > last )
+    {
+        addTags( last, 0, start - last );
+        listAdd( last, getIndex( start - last ) );
+        setPrevAlloc( start, false );
+    }
+    blockSplit( start, fullSize - ( start - last ), newsize );
+    return start + ALIGNMENT/2;
+}
+
+/*
+ * realloc
+ */
+void *realloc( void *oldptr, size_t size )
+{
+    /* IMPLEMENT THIS */
+    // Check the old pointer is null, which is the same as malloc()
+    if ( !oldptr )
+        return malloc( size );
+
+    // Check the new size is 0, which is the same as free()
+    if ( !size )
+    {
+        free( oldptr );
+        return NULL;
+    }
+
+    // Check the size of the new block overflows, and keep the old one
+    if ( size > SIZE_MAX/2 )
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if ( !in_heap(oldptr) )
+        return NULL;
+
+    uint64_t *slab = slabFind( oldptr ); // The slab that holds the old block
+
+    // If oldptr points to a location in the slabs, keep it if the new size is in the
+    // same class, otherwise move the payload and free the old object
+    if ( slab )
+    {
+        size_t oldsize = slabSize( slab ); // The size of the old object
+
+        if ( size <= oldsize && size > oldsize - ALIGNMENT )
+            return oldptr;
+
+        char *ptr = malloc( size );
+
+        // Check there is no memory for the new payload, and keep the old one
+        if ( !ptr )
+            return NULL;
+
+        mem_memcpy( ptr, oldptr, size < oldsize ? size : oldsize );
+        slabDelete( slab, oldptr );
+        return ptr;
+    }
+
+    // Check the block is a buddy, which has its own way to grow and shrink
+    if ( backend == MM_BUDDY )
+        return buddyRealloc( oldptr, size );
+
+    // If oldptr does not point to a location in the slabs:
+    char *block = (char *)oldptr - ALIGNMENT/2; // The block of the old payload
+    uint64_t header = getHeader( block ); // The header of the old block
+    size_t oldsize = header >> 3; // The size of the old block
+
+    // Check the old block is allocated
+    if ( !(header & 1) )
+        return NULL;
+
+    size_t newsize = blockSize( size );
+    bool again = header & REALLOC_BIT; // Whether realloc() has grown the block before
+
+    // If the old size is greater than or equal to the new size, free the redundant
+    // space at the end in place. A block that keeps growing keeps its headroom
+    // unless it shrinks to less than half of it.
+    if ( oldsize >= newsize )
+    {
+        if ( oldsize - newsize >= 2*ALIGNMENT && ( !again || newsize <= oldsize/2 ) )
+        {
+            addTags( block, 1, newsize );
+            addTags( block + newsize, 1, oldsize - newsize );
+            setPrevAlloc( block + newsize, true );
+            blockDelete( block + newsize + ALIGNMENT/2 );
+        }
+        return oldptr;
+    }
+
+    char *next = block + oldsize; // The block after the old block
+    size_t nextSize = 0; // The size of the next block, if it is free
+
+    // Check the next block is in heap and free
+    if ( in_heap( next ) && !(getHeader( next ) & 1) )
+        nextSize = getHeader( next ) >> 3;
+
+    size_t room = oldsize + nextSize; // The size the block can grow to without moving
+
+    bool last = !in_heap( block + room ); // Whether the block can grow into the end of the heap
+
+    // If the block can grow into the next block or the end of the heap, do it in place
+    if ( room >= newsize || last )
+    {
+        // Check the heap has to be extended, and keep the old block if it cannot be
+        if ( room < newsize )
+        {
+            if ( mem_sbrk( newsize - room ) == (void *)-1 )
+                return NULL;
+            room = newsize;
+        }
+
+        // Check the next block is in a free list
+        if ( nextSize > ALIGNMENT )
+            listDelete( next, getIndex( nextSize ) );
+        blockSplit( block, room, newsize );
+        markRealloc( block );
+        return oldptr;
+    }
+
+    // Otherwise move the payload with a single copy. A block that keeps growing gets
+    // a quarter of its new size as headroom, so the next growth can stay in place.
+    char *ptr = malloc( again ? size + size/4 : size );
+
+    // Check there is no memory for the new payload, and keep the old one
+    if ( !ptr )
+        return NULL;
+
+    mem_memcpy( ptr, oldptr, oldsize - ALIGNMENT/2 );
+    ++blockFrees[getIndex( oldsize )];
+    blockDelete( oldptr );
+
+    // Check the new payload is a block
+    if ( !slabFind( ptr ) )
+        markRealloc( ptr - ALIGNMENT/2 );
+
+    return ptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : zeroDirty
+// Description  : Clear the part of a new payload that is not known to be zero.
+//                A block carved from the free tail of the heap is zero past
+//                zeroFrom, except the links and the footer of the tail
+//
+// Inputs       : ptr - the address of the payload
+//                size - the size of the payload
+//                clean - zeroFrom before the payload was allocated
+// Outputs      : nothing
+static void zeroDirty( char *ptr, size_t size, char *clean )
+{
+    // Check the payload is in a slab, whose objects are always reused
+    if ( slabFind( ptr ) )
+    {
+        memset( ptr, 0, size );
+        return;
+    }
+
+    char *block = ptr - ALIGNMENT/2; // The block of the payload
+    char *end = ptr + size; // The end of the payload
+    char *dirty = block + EXTENT_WORDS*ALIGNMENT/2; // The end of the memory to clear, at least past the tags
+    char *footer = block + ( getHeader( block ) >> 3 ) - ALIGNMENT/2; // The last word of the block
+
+    // Check the memory known to be zero starts further
+    if ( clean > dirty )
+        dirty = clean;
+
+    // Check the payload ends first
+    if ( dirty > end )
+        dirty = end;
+    memset( ptr, 0, dirty - ptr );
+
+    // Check the last word of the block, where the footer of the tail may be, is in
+    // the payload and has not been cleared
+    if ( footer >= dirty && footer < end )
+        memset( footer, 0, end - footer );
+    return;
+}
+
+/*
+ * calloc
+ * Only the memory that has been used before is cleared, so a large payload from
+ * fresh memory at the end of the heap is never touched.
+ */
+void* calloc(size_t nmemb, size_t size)
+{
+    void* ptr;
+    char *clean = zeroFrom; // The start of the memory known to be zero before malloc()
+
+    // Check the size overflows
+    if ( nmemb && size > SIZE_MAX / nmemb )
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size *= nmemb;
+    ptr = malloc(size);
+    if (ptr) {
+        zeroDirty(ptr, size, clean);
+    }
+    return ptr;
+}
+
+/*
+ * memalign
+ * A payload aligned to more than ALIGNMENT is a block placed by blockAlign(),
+ * which gives the free space in front of it back to the free lists.
+ */
+void *memalign( size_t alignment, size_t size )
+{
+    // Check the alignment is a power of two
+    if ( !alignment || ( alignment & ( alignment - 1 ) ) )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Check every payload is aligned enough
+    if ( alignment <= ALIGNMENT )
+        return malloc( size );
+
+    // Check the size of the block, with the gap in front of it, overflows
+    if ( size > SIZE_MAX/4 || alignment > SIZE_MAX/4 )
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ++blockAllocs[getIndex( blockSize( size ) )];
+    return blockAlign( size, alignment );
+}
+
+/*
+ * posix_memalign
+ */
+int posix_memalign( void **memptr, size_t alignment, size_t size )
+{
+    // Check the alignment is a power of two and a multiple of the size of a pointer
+    if ( !alignment || ( alignment & ( alignment - 1 ) ) || alignment % sizeof(void *) )
+        return EINVAL;
+
+    void *ptr = memalign( alignment, size ); // The aligned payload
+
+    // Check the heap is out of memory
+    if ( !ptr )
+        return ENOMEM;
+
+    *memptr = ptr;
+    return 0;
+}
+
+/*
+ * aligned_alloc
+ */
+void *aligned_alloc( size_t alignment, size_t size )
+{
+    return memalign( alignment, size );
+}
+
+/*
+ * malloc_usable_size
+ * Returns the bytes the caller may use: the whole object of a slab, or the
+ * whole block without its header.
+ */
+size_t malloc_usable_size( void *ptr )
+{
+    // Check the pointer is null
+    if ( !ptr )
+        return 0;
+
+    uint64_t *slab = slabFind( ptr ); // The slab that holds the payload
+
+    // Check the payload is in a slab
+    if ( slab )
+        return slabSize( slab );
+
+    return ( getHeader( (char *)ptr - ALIGNMENT/2 ) >> 3 ) - ALIGNMENT/2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabBatch
+// Description  : Allocate many blocks of one size in slabs, taking all the free
+//                objects of a word of a bitmap with one store
+//
+// Inputs       : size - the size of the blocks
+//                n - the number of blocks
+//                out - where to save the addresses of the blocks
+// Outputs      : the number of blocks
+static size_t slabBatch( size_t size, size_t n, void **out )
+{
+    uint8_t cls = slabClass( size ); // The slab class of the blocks
+    size_t objSize = (cls + 1)*ALIGNMENT; // The size of an object
+    uint64_t *dir = slabDir( cls ); // The directory of the class
+    size_t got = 0; // The number of blocks allocated
+
+    // Loop until there are enough blocks, making new slabs as needed
+    while ( dir && got < n )
+    {
+        uint64_t *slab = (uint64_t *)dir[DIR_PARTIAL]; // The first slab with a free object
+
+        // Check there is no partial slab, and no memory for a new one
+        if ( !slab && !( slab = slabNew( cls, dir ) ) )
+            break;
+
+        size_t count = ( slab[SLAB_INFO] >> 16 ) & 0xffff; // The number of objects in the slab
+        char *objects = (char *)slab + slabHeadSize( count ); // The first object
+        uint64_t *map = slab + SLAB_MAP; // The bitmap
+
+        // Loop through the words of the bitmap until the slab is full
+        while ( got < n && slab[SLAB_USED] < count )
+        {
+            uint64_t avail = ~*map; // The free objects of the word
+            uint64_t taken = 0; // The objects taken from the word
+
+            // Take the free objects of the word from the lowest
+            while ( avail && got < n )
+            {
+                uint64_t bit = avail & -avail; // The lowest free object
+                out[got++] = objects + ( (map - slab - SLAB_MAP)*64 + __builtin_ctzll( avail ) )*objSize;
+                taken |= bit;
+                avail ^= bit;
+                ++slab[SLAB_USED];
+                ++dir[DIR_USED];
+                ++dir[DIR_ALLOCS];
+            }
+            *map++ |= taken;
+        }
+
+        // Check the slab becomes full
+        if ( slab[SLAB_USED] == count )
+            partialDelete( slab, dir );
+    }
+    return got;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockBatch
+// Description  : Allocate many blocks of one size one after another from one
+//                free block, or from the end of the heap
+//
+// Inputs       : size - the size of the payloads
+//                n - the number of blocks
+//                out - where to save the addresses of the payloads
+// Outputs      : the number of blocks
+static size_t blockBatch( size_t size, size_t n, void **out )
+{
+    // Check the blocks are buddies, which are taken one at a time
+    if ( backend == MM_BUDDY )
+    {
+        for ( size_t i = 0; i < n; ++i )
+        {
+            if ( !( out[i] = buddyAdd( size ) ) )
+                return i;
+        }
+        return n;
+    }
+
+    size_t newsize = blockSize( size ); // The size of a block
+    size_t fullSize = 0; // The size of the free block
+    char *block = blockFit( n*newsize, &fullSize ); // The free block
+
+    // Check no free block has room for all the blocks, and coalesce the quick lists
+    // before giving up
+    if ( !block && quickFlush() )
+        block = blockFit( n*newsize, &fullSize );
+
+    // Check no free block has room for all the blocks, and grow the heap
+    if ( !block )
+    {
+        block = heapLast();
+        fullSize = heapGrow( block, n*newsize );
+
+        // Check there is no memory left
+        if ( !fullSize )
+            return 0;
+    }
+
+    // Carve the blocks from the front; every block after the first follows an
+    // allocated one, and the last one gives the rest back
+    for ( size_t i = 0; i + 1 < n; ++i )
+    {
+        addTags( block, 1, newsize );
+        out[i] = block + ALIGNMENT/2;
+        block += newsize;
+        fullSize -= newsize;
+        putHeader( block, PREV_ALLOC );
+    }
+    blockSplit( block, fullSize, newsize );
+    out[n - 1] = block + ALIGNMENT/2;
+    return n;
+}
+
+/*
+ * mm_malloc_batch
+ * Allocates n payloads of one size at once, and returns how many it allocated.
+ */
+size_t mm_malloc_batch( size_t size, size_t n, void **out )
+{
+    size_t got = 0; // The number of payloads allocated
+
+    // Check there is nothing to allocate, or the size of all the blocks overflows
+    if ( !n || size > SIZE_MAX/2/n )
+        return 0;
+
+    // Check the size is small enough for the slabs
+    if ( size <= SLAB_MAX )
+        return slabBatch( size, n, out );
+
+    heapLock();
+    blockAllocs[getIndex( blockSize( size ) )] += n;
+    got = blockBatch( size, n, out );
+    heapUnlock();
+    return got;
+}
+
+/*
+ * mm_free_batch
+ * Frees n payloads at once. The payloads next to each other in the array that
+ * share a slab update the counter and the partial list of the slab only once.
+ */
+void mm_free_batch( void **ptrs, size_t n )
+{
+    size_t i = 0; // The next payload
+
+    // Loop through the payloads
+    while ( i < n )
+    {
+        char *ptr = ptrs[i++]; // The payload
+
+        // Check the pointer is null
+        if ( !ptr )
+            continue;
+
+        uint64_t *slab = slabFind( ptr ); // The slab that holds the payload
+
+        // Check the payload is a block
+        if ( !slab )
+        {
+            heapLock();
+            blockFree( ptr );
+            heapUnlock();
+            continue;
+        }
+
+        size_t freed = 1; // The number of payloads freed in the slab
+        slabClear( slab, ptr );
+
+        // Clear the payloads that follow in the same page, which is the slab
+        while ( i < n && ptrs[i] &&
+                ( (uintptr_t)ptrs[i] & ~(uintptr_t)( SLAB_BYTES - 1 ) ) == (uintptr_t)slab )
+        {
+            slabClear( slab, ptrs[i++] );
+            ++freed;
+        }
+        slabRelease( slab, freed );
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleSlot
+// Description  : Take an empty slot of the handle table, and add a node to the
+//                table when every slot is taken
+//
+// Inputs       : nothing
+// Outputs      : the slot, or null if there is no memory for a node
+static uint64_t *handleSlot( void )
+{
+    // Check every slot is taken, and stack the slots of a new node
+    if ( !handleEmpty )
+    {
+        uint64_t *node = blockAdd( HANDLE_WORDS*sizeof(uint64_t) ); // The new node
+
+        // Check there is no memory for the node
+        if ( !node )
+            return NULL;
+
+        node[HANDLE_NEXT] = (uint64_t)handleNodes;
+        handleNodes = node;
+        for ( int i = HANDLE_WORDS - 1; i > HANDLE_NEXT; --i )
+        {
+            node[i] = (uint64_t)handleEmpty | 1;
+            handleEmpty = &node[i];
+        }
+    }
+
+    uint64_t *slot = handleEmpty; // The first empty slot
+    handleEmpty = (uint64_t *)( *slot & ~1ull );
+    return slot;
+}
+
+/*
+ * mm_halloc
+ * Allocates a relocatable payload, and returns its handle. The payload is at
+ * *handle, which mm_compact() may change unless the handle is locked.
+ */
+void **mm_halloc( size_t size )
+{
+    // Check the size of the block overflows
+    if ( size > SIZE_MAX/2 )
+        return NULL;
+
+    heapLock();
+    uint64_t *slot = handleSlot(); // The slot of the handle
+    uint64_t *head = slot ? blockAdd( size + HANDLE_HEAD ) : NULL; // The head of the payload
+
+    // Check there is no memory for the payload, and give the slot back
+    if ( !head )
+    {
+        // Check there is a slot to give back
+        if ( slot )
+        {
+            *slot = (uint64_t)handleEmpty | 1;
+            handleEmpty = slot;
+        }
+        heapUnlock();
+        return NULL;
+    }
+
+    ++blockAllocs[getIndex( blockSize( size + HANDLE_HEAD ) )];
+    head[HANDLE_SLOT] = (uint64_t)slot;
+    head[HANDLE_LOCKS] = 0;
+    *slot = (uint64_t)head + HANDLE_HEAD;
+    heapUnlock();
+    return (void **)slot;
+}
+
+/*
+ * mm_hlock
+ * Locks a handle, so that mm_compact() leaves its payload where it is, and
+ * returns the payload. Locks nest, and every one needs an mm_hunlock().
+ */
+void *mm_hlock( void **handle )
+{
+    heapLock();
+    uint64_t *head = (uint64_t *)( (char *)*handle - HANDLE_HEAD ); // The head of the payload
+    ++head[HANDLE_LOCKS];
+    heapUnlock();
+    return *handle;
+}
+
+/*
+ * mm_hunlock
+ * Takes one lock off a handle.
+ */
+void mm_hunlock( void **handle )
+{
+    heapLock();
+    uint64_t *head = (uint64_t *)( (char *)*handle - HANDLE_HEAD ); // The head of the payload
+
+    // Check the handle is locked
+    if ( head[HANDLE_LOCKS] )
+        --head[HANDLE_LOCKS];
+    heapUnlock();
+    return;
+}
+
+/*
+ * mm_hfree
+ * Frees the payload of a handle and the handle, locked or not.
+ */
+void mm_hfree( void **handle )
+{
+    // Check the handle is null
+    if ( !handle )
+        return;
+
+    heapLock();
+    uint64_t *slot = (uint64_t *)handle; // The slot of the handle
+    blockFree( (char *)*slot - HANDLE_HEAD );
+    *slot = (uint64_t)handleEmpty | 1;
+    handleEmpty = slot;
+    heapUnlock();
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compactMark
+// Description  : Mark the blocks that mm_compact() may move, the payloads of the
+//                unlocked handles, with the realloc bit, which is cleared from
+//                every other block first
+//
+// Inputs       : nothing
+// Outputs      : nothing
+static void compactMark( void )
+{
+    char *end = (char *)mem_heap_hi() + 1; // The end of the heap
+
+    for ( char *block = firstBlock; block < end; block += getHeader( block ) >> 3 )
+    {
+        // Check the block is allocated, so it may have the bit
+        if ( getHeader( block ) & 1 )
+            putHeader( block, getHeader( block ) & ~(uint64_t)REALLOC_BIT );
+    }
+
+    for ( uint64_t *node = handleNodes; node; node = (uint64_t *)node[HANDLE_NEXT] )
+    {
+        for ( int i = HANDLE_NEXT + 1; i < HANDLE_WORDS; ++i )
+        {
+            char *head = (char *)node[i] - HANDLE_HEAD; // The head of the payload of the slot
+
+            // Check the slot holds an unlocked handle
+            if ( !( node[i] & 1 ) && !((uint64_t *)head)[HANDLE_LOCKS] )
+                markRealloc( head - ALIGNMENT/2 );
+        }
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compactSlide
+// Description  : Walk the heap, and slide the marked blocks that follow a free
+//                block down over it one after another, so the free block moves
+//                up past them until it coalesces with the next free block, or
+//                stops in front of a block that cannot move. The marks are cleared
+//
+// Inputs       : nothing
+// Outputs      : nothing
+static void compactSlide( void )
+{
+    const uint64_t marked = REALLOC_BIT | 1; // The bits of a block that may move
+    char *end = (char *)mem_heap_hi() + 1; // The end of the heap
+    char *block = firstBlock; // The block to look at
+
+    while ( block < end )
+    {
+        uint64_t header = getHeader( block ); // The header of the block
+        size_t size = header >> 3; // The size of the block
+        char *next = block + size; // The block after it
+
+        // Check the block is allocated, or no marked block follows the free block
+        if ( ( header & 1 ) || next >= end || ( getHeader( next ) & marked ) != marked )
+        {
+            // Check the block is marked, and stays where it is
+            if ( header & REALLOC_BIT )
+                putHeader( block, header & ~(uint64_t)REALLOC_BIT );
+            block = next;
+            continue;
+        }
+
+        // Check the size of the free block is greater than 16
+        if ( size > ALIGNMENT )
+            listDelete( block, getIndex( size ) );
+
+        // Move the marked blocks down, and point their handles at them. The block
+        // in front of a free block is always allocated
+        while ( next < end && ( getHeader( next ) & marked ) == marked )
+        {
+            size_t moved = getHeader( next ) >> 3; // The size of the marked block
+            uint64_t *head = (uint64_t *)( block + ALIGNMENT/2 ); // The head of the moved payload
+            memmove( head, next + ALIGNMENT/2, moved - ALIGNMENT/2 );
+            putHeader( block, ( moved << 3 ) | PREV_ALLOC | 1 );
+            *(uint64_t *)head[HANDLE_SLOT] = (uint64_t)head + HANDLE_HEAD;
+            block += moved;
+            next += moved;
+        }
+
+        // Free the space left behind, which coalesces with a free block after it,
+        // and look at it again, since more marked blocks may follow that one
+        putHeader( block, ( size << 3 ) | PREV_ALLOC | 1 );
+        blockDelete( block + ALIGNMENT/2 );
+        end = (char *)mem_heap_hi() + 1;
+    }
+    return;
+}
+
+/*
+ * mm_compact
+ * Slides the payloads of the unlocked handles down over the free blocks in
+ * front of them, so that the free space gathers at the end of the heap, and
+ * trims the heap down to TRIM_KEEP bytes of it. Returns the bytes given back.
+ * The payloads of malloc() and the slabs stay where they are, and so do the
+ * buddy blocks, whose places are fixed by their sizes.
+ */
+size_t mm_compact( void )
+{
+    // Check the blocks are buddies
+    if ( backend == MM_BUDDY )
+        return 0;
+
+    heapLock();
+    size_t before = mem_heapsize(); // The size of the heap before the compaction
+    quickFlush();
+    compactMark();
+    compactSlide();
+
+    tailTrim();
+
+    size_t given = before - mem_heapsize(); // The bytes given back
+    heapUnlock();
+    return given;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : statsSlabs
+// Description  : Add the counters of a set of slab directories to the statistics
+//
+// Inputs       : dirs - the slab directories of an arena
+//                stats - the statistics
+// Outputs      : nothing
+static void statsSlabs( uint64_t **dirs, struct mm_stats *stats )
+{
+    for ( int index = 0; index < slabDirCount; ++index )
+    {
+        uint64_t *dir = dirs[index]; // The directory
+        int cls = index % SLAB_CLASSES; // The class of the directory
+
+        // Check the class has no directory yet
+        if ( !dir )
+            continue;
+
+        stats->slabAllocs[cls] += dir[DIR_ALLOCS];
+        stats->slabFrees[cls] += dir[DIR_ALLOCS] - dir[DIR_USED];
+        stats->slabCount[cls] += dir[DIR_SLABS];
+        stats->slabUsed[cls] += dir[DIR_USED];
+        stats->slabBytes += dir[DIR_SLABS]*SLAB_BYTES;
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : statsBlocks
+// Description  : Fill in the counters of the blocks and the heap. Only the
+//                largest free block is looked for, in the last non-empty class
+//
+// Inputs       : stats - the statistics
+// Outputs      : nothing
+static void statsBlocks( struct mm_stats *stats )
+{
+    for ( int i = 0; i < NUM_CLASSES; ++i )
+    {
+        stats->blockAllocs[i] = blockAllocs[i];
+        stats->blockFrees[i] = blockFrees[i];
+        stats->freeBlocks[i] = listCounts[i];
+        stats->freeBytes[i] = listBytes[i];
+        stats->listBytes += listBytes[i];
+    }
+
+    for ( int i = 0; i < QUICK_CLASSES; ++i )
+        stats->quickBytes += quickCounts[i]*(i + 1)*ALIGNMENT;
+
+    int last = NUM_CLASSES - 1; // The last non-empty class
+    while ( last >= 0 && !lists[last] )
+        --last;
+
+    // Check the blocks are buddies, whose largest free block is of the highest free
+    // order, or the last class is the tree, whose largest block is its rightmost node
+    if ( backend == MM_BUDDY )
+    {
+        stats->largestFree = buddyOrders ? 1ull << ( 63 - __builtin_clzll( buddyOrders ) ) : 0;
+    }
+    else if ( last == TREE_CLASS )
+    {
+        char *node = lists[last];
+        while ( *treeRight( node ) )
+            node = *treeRight( node );
+        stats->largestFree = getHeader( node ) >> 3;
+    }
+    else if ( last >= 0 )
+    {
+        for ( char *ptr = lists[last]; ptr; ptr = getSucc( ptr ) )
+        {
+            if ( getHeader( ptr ) >> 3 > stats->largestFree )
+                stats->largestFree = getHeader( ptr ) >> 3;
+        }
+    }
+
+    stats->heapBytes = mem_heapsize();
+    stats->fragmentation = stats->listBytes ? 1.0 - (double)stats->largestFree / stats->listBytes : 0.0;
+    stats->sbrkCalls = mem_sbrk_count();
+    stats->slabHot = slabHot;
+    return;
+}
+
+#ifdef DRIVER
+/*
+ * mm_stats
+ * Fills in the counters of the allocator. They are kept up to date as the heap
+ * changes, so this only adds them up.
+ */
+void mm_stats( struct mm_stats *stats )
+{
+    memset( stats, 0, sizeof(*stats) );
+    statsSlabs( slabDirs, stats );
+    statsBlocks( stats );
+    return;
+}
+#endif /* DRIVER */
+
+/*
+ * Returns whether the pointer is in the heap.
+ * May be useful for debugging.
+ */
+static bool in_heap(const void* p)
+{
+    return p <= mem_heap_hi() && p >= mem_heap_lo();
+}
+
+/*
+ * Returns whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static bool aligned(const void* p)
+{
+    size_t ip = (size_t) p;
+    return align(ip) == ip;
+}
+
+#ifdef DEBUG
+/*
+ * Check a subtree of the tree of large free blocks, whose blocks all come after
+ * lo and before hi
+ */
+static bool treeCheck( char *node, char *lo, char *hi )
+{
+    if ( !node )
+        return true;
+
+    if ( getHeader( node ) & 1 || ( getHeader( node ) >> 3 ) < ( 1ull << TREE_EXP ) )
+    {
+        fprintf( stderr, "Block %p in the tree is not a large free block.\n", node );
+        return false;
+    }
+
+    if ( ( lo && !treeLess( lo, node ) ) || ( hi && !treeLess( node, hi ) ) )
+    {
+        fprintf( stderr, "Block %p is out of order in the tree.\n", node );
+        return false;
+    }
+
+    char *left = *treeLeft( node );
+    char *right = *treeRight( node );
+    if ( ( left && treePriority( left ) > treePriority( node ) ) ||
+         ( right && treePriority( right ) > treePriority( node ) ) )
+    {
+        fprintf( stderr, "Block %p has a child with a higher priority.\n", node );
+        return false;
+    }
+
+    return treeCheck( left, lo, node ) && treeCheck( right, node, hi );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extentCheck
+// Description  : Check a subtree of the tree of extents: its order by address,
+//                its priorities and the largest size of every node, and count it
+//
+// Inputs       : node - the root of the subtree
+//                lo - the block every node must be above, or null
+//                hi - the block every node must be below, or null
+//                count - the number of nodes, which the subtree is added to
+// Outputs      : whether the subtree is consistent
+static bool extentCheck( char *node, char *lo, char *hi, uint64_t *count )
+{
+    if ( !node )
+        return true;
+
+    if ( getHeader( node ) & 1 || ( getHeader( node ) >> 3 ) < EXTENT_MIN )
+    {
+        fprintf( stderr, "Block %p in the tree of extents is not a free extent.\n", node );
+        return false;
+    }
+
+    if ( ( lo && node <= lo ) || ( hi && node >= hi ) )
+    {
+        fprintf( stderr, "Block %p is out of order in the tree of extents.\n", node );
+        return false;
+    }
+
+    char *left = *extentLeft( node );
+    char *right = *extentRight( node );
+    if ( ( left && treePriority( left ) > treePriority( node ) ) ||
+         ( right && treePriority( right ) > treePriority( node ) ) )
+    {
+        fprintf( stderr, "Extent %p has a child with a higher priority.\n", node );
+        return false;
+    }
+
+    size_t max = getHeader( node ) >> 3;
+    if ( extentMax( left ) > max )
+        max = extentMax( left );
+    if ( extentMax( right ) > max )
+        max = extentMax( right );
+    if ( extentMax( node ) != max )
+    {
+        fprintf( stderr, "Extent %p says its largest block is %lu, not %lu.\n", node,
+            (unsigned long)extentMax( node ), (unsigned long)max );
+        return false;
+    }
+
+    ++*count;
+    return extentCheck( left, lo, node, count ) && extentCheck( right, node, hi, count );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blockCheck
+// Description  : Check the blocks of the segregate free lists: walk the heap,
+//                and look every free block up in its list
+//
+// Inputs       : nothing
+// Outputs      : whether the blocks are consistent
+static bool blockCheck( void )
+{
+    char *preBlock = NULL;
+    char *ptr = firstBlock; // make ptr points to the first block
+    uint8_t isPreValid = 1;
+    uint8_t isValid = 1;
+    size_t size = 0;
+    uint64_t extentBlocks = 0; // The extents found
+    uint64_t counts[NUM_CLASSES] = { 0 }; // The free blocks found in each class
+    uint64_t bytes[NUM_CLASSES] = { 0 }; // The bytes of the free blocks found in each class
+    while ( ptr < (char *)mem_heap_hi() )
+    {
+        // Is every payload aligned with 16?
+        if ( !aligned( ptr + ALIGNMENT/2 ) )
+        {
+            fprintf( stderr, "Payload of the block %p is not in aligned.\n", ptr );
+            return false;
+        }
+
+        // Are there contiguous free blocks that escape coalescing?
+        isValid = getHeader( ptr ) & 1;
+        size = getHeader( ptr ) >> 3;
+        if ( isPreValid == isValid && isPreValid == 0 )
+        {
+            fprintf( stderr, "Contiguous free blocks %p and %p escape coalescing.\n",
+                preBlock, ptr );
+            return false;
+        }
+
+        // Does every block know whether the block in front of it is allocated?
+        if ( isPrevAlloc( ptr ) != ( isPreValid == 1 ) )
+        {
+            fprintf( stderr, "Block %p has a wrong bit for the previous block.\n", ptr );
+            return false;
+        }
+
+        // Does the footer of every free block match its header? Only the header knows
+        // whether the previous block is allocated
+        if ( !isValid && ( getFooter( ptr + size ) | PREV_ALLOC ) != ( getHeader( ptr ) | PREV_ALLOC ) )
+        {
+            fprintf( stderr, "Footer of the free block %p does not match.\n", ptr );
+            return false;
+        }
+
+        // Is every free block actually in free lists?
+        if ( !isValid && size > ALIGNMENT )
+        {
+            bool found = false;
+            char *tmp = lists[getIndex(size)];
+            char *succ = NULL;
+            while ( getIndex(size) == TREE_CLASS && tmp && tmp != ptr )
+                tmp = treeLess( ptr, tmp ) ? *treeLeft( tmp ) : *treeRight( tmp );
+            while ( tmp )
+            {
+                succ = getSucc( tmp );
+                if ( tmp == ptr )
+                {
+                    found = true;
+                    break;
+                }
+                tmp = succ;
+            }
+            if ( !found )
+            {
+                fprintf( stderr, "Free block %p is not in free lists.\n", ptr );
+                return false;
+            }
+            ++counts[getIndex(size)];
+            bytes[getIndex(size)] += size;
+            extentBlocks += size >= EXTENT_MIN;
+        }
+        isPreValid = isValid;
+        preBlock = ptr;
+        ptr += size;
+    }
+
+    if ( lastAlloc != ( isPreValid == 1 ) )
+    {
+        fprintf( stderr, "The last block %p has a wrong bit at the end of the heap.\n",
+            preBlock );
+        return false;
+    }
+
+    char *succ = NULL;
+    bool roverSeen = false;
+    bool victimSeen = false;
+
+    for ( int i = 0; i < NUM_CLASSES; ++i )
+    {
+        // Does the bitmap agree with the list?
+        if ( !lists[i] != !( nonEmpty[i >> 6] & ( 1ull << (i & 63) ) ) )
+        {
+            fprintf( stderr, "Bitmap bit of free list %d is out of date.\n", i );
+            return false;
+        }
+
+        // Do the counters of every list match its blocks?
+        if ( counts[i] != listCounts[i] || bytes[i] != listBytes[i] )
+        {
+            fprintf( stderr, "Free list %d counts %lu blocks of %lu bytes but has %lu of %lu.\n", i,
+                (unsigned long)listCounts[i], (unsigned long)listBytes[i],
+                (unsigned long)counts[i], (unsigned long)bytes[i] );
+            return false;
+        }
+
+        // Is the tree of large free blocks ordered by size and address, and a heap by priority?
+        if ( i == TREE_CLASS )
+        {
+            if ( !treeCheck( lists[i], NULL, NULL ) )
+                return false;
+
+            // Is every extent in the tree of extents, ordered by address?
+            uint64_t extentCount = 0;
+            if ( !extentCheck( extents, NULL, NULL, &extentCount ) )
+                return false;
+            if ( extentCount != extentBlocks )
+            {
+                fprintf( stderr, "The tree of extents has %lu blocks, not %lu.\n",
+                    (unsigned long)extentCount, (unsigned long)extentBlocks );
+                return false;
+            }
+            continue;
+        }
+
+        ptr = lists[i];
+        while ( ptr )
+        {
+            // Is every block in the free lists actually free?
+            isValid = getHeader( ptr ) & 1;
+            succ = getSucc( ptr );
+            if ( isValid )
+            {
+                fprintf( stderr, "Block %p in free list %d is not marked free.\n", ptr, i );
+                return false;
+            }
+
+            // Is the list ordered by address with address-ordered first fit?
+            if ( policy == MM_ADDRESS_FIT && succ && succ < ptr )
+            {
+                fprintf( stderr, "Free list %d is not ordered by address at %p.\n", i, ptr );
+                return false;
+            }
+
+            // Is the rover of next fit in the list of its class?
+            if ( ptr == rover )
+                roverSeen = roverClass == i;
+
+            // Is the designated victim in a free list?
+            if ( ptr == victim )
+                victimSeen = true;
+            ptr = succ;
+        }
+    }
+
+    // Is the rover of next fit still a free block?
+    if ( rover && !roverSeen )
+    {
+        fprintf( stderr, "Rover %p is not in free list %d.\n", rover, roverClass );
+        return false;
+    }
+
+    // Is the designated victim still a free block below the tree?
+    if ( victim && !victimSeen )
+    {
+        fprintf( stderr, "Designated victim %p is not in the free lists.\n", victim );
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buddyCheck
+// Description  : Check the buddy blocks: walk the heap, and compare every block
+//                with its order, its list, its buddy and the bitmap of free buddies
+//
+// Inputs       : nothing
+// Outputs      : whether the buddy blocks are consistent
+static bool buddyCheck( void )
+{
+    uint64_t counts[NUM_CLASSES] = { 0 }; // The free blocks found in each class
+    uint64_t bytes[NUM_CLASSES] = { 0 }; // The bytes of the free blocks found in each class
+    size_t marked = 0; // The free blocks found
+    char *end = (char *)mem_heap_hi() + 1; // The end of the heap
+    char *ptr = buddyBase;
+
+    while ( ptr < end )
+    {
+        size_t size = getHeader( ptr ) >> 3;
+        size_t offset = ptr - buddyBase;
+        bool isFree = !( getHeader( ptr ) & 1 );
+
+        // Is every block a power of two, at an offset of a multiple of its size?
+        if ( size < 1ull << BUDDY_MIN || ( size & ( size - 1 ) ) || offset % size || !aligned( ptr + ALIGNMENT/2 ) )
+        {
+            fprintf( stderr, "Buddy block %p of %lu bytes is out of place.\n", ptr, (unsigned long)size );
+            return false;
+        }
+        unsigned order = __builtin_ctzll( size );
+
+        // Does the bitmap of free buddies mark exactly the free blocks?
+        size_t unit = offset >> BUDDY_MIN;
+        if ( unit/64 < buddyMapWords && ( buddyMap[unit/64] >> (unit % 64) & 1 ) != isFree )
+        {
+            fprintf( stderr, "Buddy block %p is marked wrong in the bitmap.\n", ptr );
+            return false;
+        }
+
+        if ( isFree )
+        {
+            // Does every free block escape merging with a free buddy?
+            char *buddy = buddyBase + ( offset ^ size );
+            if ( buddy < end && buddyIsFree( buddy, order ) )
+            {
+                fprintf( stderr, "Free buddies %p and %p escape merging.\n", ptr, buddy );
+                return false;
+            }
+
+            // Is every free block in the list of its order?
+            char *tmp = buddyLists[order];
+            while ( tmp && tmp != ptr )
+                tmp = getSucc( tmp );
+            if ( !tmp )
+            {
+                fprintf( stderr, "Free buddy block %p is not in the list of order %u.\n", ptr, order );
+                return false;
+            }
+            ++marked;
+            ++counts[getIndex( size )];
+            bytes[getIndex( size )] += size;
+        }
+        ptr += size;
+    }
+
+    // Does the heap end with a whole block?
+    if ( ptr != end )
+    {
+        fprintf( stderr, "The last buddy block runs past the end of the heap.\n" );
+        return false;
+    }
+
+    size_t listed = 0;
+    for ( int order = 0; order < BUDDY_ORDERS; ++order )
+    {
+        // Does the bitmap of orders agree with the lists?
+        if ( !buddyLists[order] != !( buddyOrders >> order & 1 ) )
+        {
+            fprintf( stderr, "Bitmap bit of buddy order %d is out of date.\n", order );
+            return false;
+        }
+
+        // Is every block in a list free and of its order?
+        for ( ptr = buddyLists[order]; ptr; ptr = getSucc( ptr ) )
+        {
+            if ( getHeader( ptr ) != ( 1ull << order ) << 3 )
+            {
+                fprintf( stderr, "Block %p in buddy list %d is not free or of that order.\n", ptr, order );
+                return false;
+            }
+            ++listed;
+        }
+    }
+    if ( listed != marked )
+    {
+        fprintf( stderr, "The buddy lists have %lu blocks but the heap has %lu free.\n",
+            (unsigned long)listed, (unsigned long)marked );
+        return false;
+    }
+
+    // Do the counters of every class match its free buddies?
+    for ( int i = 0; i < NUM_CLASSES; ++i )
+    {
+        if ( counts[i] != listCounts[i] || bytes[i] != listBytes[i] || lists[i] )
+        {
+            fprintf( stderr, "Class %d counts %lu free buddies of %lu bytes but has %lu of %lu.\n", i,
+                (unsigned long)listCounts[i], (unsigned long)listBytes[i],
+                (unsigned long)counts[i], (unsigned long)bytes[i] );
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif /* DEBUG */
+
+/*
+ * mm_checkheap
+ * Check the heap for the followings:
+ *   1. Is every payload aligned with 16?
+ *   2. Are there contiguous free blocks that escape coalescing?
+ *   3. Is there any free block not in free lists?
+ *   4. Is every free block actually in free lists?
+ *   5. Is every block in the free lists actually free?
+ *   6. Does the used counter of every slab match its bitmap?
+ *   7. Is every slab on the partial list exactly when it has a free location?
+ *   8. Are the slab pages in the bitmap exactly the pages of the slabs?
+ *   9. Does every block know whether the block in front of it is allocated?
+ *  10. Does the footer of every free block match its header, but the bit for the previous block?
+ *  11. Is the tree of large free blocks ordered by size and address, and a heap by priority?
+ *  12. Is every extent in the tree of extents, ordered by address, with the largest size of its subtree?
+ *  13. Is the payload of every handle in an allocated block that points back to the handle?
+ */
+bool mm_checkheap(int lineno)
+{
+#ifdef DEBUG
+    /* Write code to check heap invariants here */
+    /* IMPLEMENT THIS */
+    // Are the blocks consistent with their lists?
+    if ( !( backend == MM_BUDDY ? buddyCheck() : blockCheck() ) )
+        return false;
+
+    char *ptr = NULL;
+    size_t quick = 0;
+    for ( int i = 0; i < QUICK_CLASSES; ++i )
+    {
+        size_t count = 0;
+        for ( ptr = quickLists[i]; ptr; ptr = *(char **)( ptr + ALIGNMENT/2 ) )
+        {
+            // Is every block in a quick list still marked allocated, and of the size of the list?
+            if ( !( getHeader( ptr ) & 1 ) || ( getHeader( ptr ) >> 3 ) != (size_t)( i + 1 )*ALIGNMENT )
+            {
+                fprintf( stderr, "Block %p in quick list %d is free or of the wrong size.\n", ptr, i );
+                return false;
+            }
+            ++count;
+        }
+
+        // Does every quick list count its blocks?
+        if ( count != quickCounts[i] || count > QUICK_BOUND )
+        {
+            fprintf( stderr, "Quick list %d counts %lu blocks but has %lu.\n", i,
+                (unsigned long)quickCounts[i], (unsigned long)count );
+            return false;
+        }
+        quick += count;
+    }
+    if ( quick != quickTotal )
+    {
+        fprintf( stderr, "The quick lists count %lu blocks but have %lu.\n",
+            (unsigned long)quickTotal, (unsigned long)quick );
+        return false;
+    }
+
+    // Does the number of hot slab classes match their bitmap?
+    if ( (unsigned)__builtin_popcountll( slabHot ) != slabHotCount )
+    {
+        fprintf( stderr, "%u slab classes are hot but %d are marked.\n", slabHotCount,
+            __builtin_popcountll( slabHot ) );
+        return false;
+    }
+
+    size_t slabs = 0;
+    for ( int index = 0; index < slabDirCount; ++index )
+    {
+        uint64_t *dir = slabDirs[index];
+        if ( !dir )
+            continue;
+
+        size_t classSlabs = 0, classUsed = 0, partial = 0, slots = 0, empty = 0;
+        for ( uint64_t *node = dir; node; node = (uint64_t *)node[DIR_NEXT] )
+        {
+            for ( int slot = DIR_SLOTS; slot < DIR_WORDS; ++slot )
+            {
+                ++slots;
+                uint64_t *slab = (uint64_t *)node[slot];
+                if ( (uint64_t)slab & 1 )
+                    continue;
+
+                // Does every slab know its slot?
+                ++slabs;
+                ++classSlabs;
+                if ( slab[SLAB_SLOT] != (uint64_t)&node[slot] || slabIndex( slab ) != index )
+                {
+                    fprintf( stderr, "Slab %p is in the wrong slot, class or lifetime.\n", slab );
+                    return false;
+                }
+
+                // Are the slab pages in the bitmap exactly the pages of the slabs?
+                if ( slabFind( (char *)slab + ALIGNMENT ) != slab )
+                {
+                    fprintf( stderr, "Page of slab %p is not marked.\n", slab );
+                    return false;
+                }
+
+                // Does the used counter of every slab match its bitmap?
+                size_t count = ( slab[SLAB_INFO] >> 16 ) & 0xffff;
+                size_t used = 0;
+                for ( size_t i = 0; i < count; ++i )
+                    used += ( slab[SLAB_MAP + i/64] >> (i % 64) ) & 1;
+                if ( used != slab[SLAB_USED] )
+                {
+                    fprintf( stderr, "Slab %p counts %lu objects but has %lu.\n", slab,
+                        (unsigned long)slab[SLAB_USED], (unsigned long)used );
+                    return false;
+                }
+                classUsed += used;
+                partial += used < count;
+            }
+        }
+
+        // Is every slab on the partial list exactly when it has a free location?
+        for ( uint64_t *slab = (uint64_t *)dir[DIR_PARTIAL]; slab; slab = (uint64_t *)slab[SLAB_NEXT] )
+        {
+            if ( slab[SLAB_USED] == ( ( slab[SLAB_INFO] >> 16 ) & 0xffff ) || !partial-- )
+            {
+                fprintf( stderr, "Slab %p is misplaced on the partial list.\n", slab );
+                return false;
+            }
+        }
+        if ( partial )
+        {
+            fprintf( stderr, "A partial slab of directory %d is not on the partial list.\n", index );
+            return false;
+        }
+
+        // Does every empty slot lie on the stack of empty slots?
+        for ( uint64_t *slot = (uint64_t *)dir[DIR_EMPTY]; slot; slot = (uint64_t *)( *slot & ~1ull ) )
+            ++empty;
+        if ( empty + classSlabs != slots )
+        {
+            fprintf( stderr, "Directory %d loses empty slots.\n", index );
+            return false;
+        }
+
+        // Do the counters of the class match its slabs?
+        if ( dir[DIR_SLABS] != classSlabs || dir[DIR_USED] != classUsed )
+        {
+            fprintf( stderr, "Directory %d counts %lu slabs and %lu objects but has %lu and %lu.\n", index,
+                (unsigned long)dir[DIR_SLABS], (unsigned long)dir[DIR_USED],
+                (unsigned long)classSlabs, (unsigned long)classUsed );
+            return false;
+        }
+    }
+
+    for ( size_t i = 0; i < slabPageWords; ++i )
+        slabs -= __builtin_popcountll( slabPages[i] );
+    if ( slabs )
+    {
+        fprintf( stderr, "The bitmap of slab pages has pages without a slab.\n" );
+        return false;
+    }
+
+    uint64_t handles = 0; // The slots of the handle table
+    for ( uint64_t *node = handleNodes; node; node = (uint64_t *)node[HANDLE_NEXT] )
+    {
+        handles += HANDLES_PER_NODE;
+        for ( int i = HANDLE_NEXT + 1; i < HANDLE_WORDS; ++i )
+        {
+            // Check the slot is empty
+            if ( node[i] & 1 )
+                continue;
+
+            --handles;
+            ptr = (char *)node[i] - HANDLE_HEAD - ALIGNMENT/2;
+
+            // Is the payload of every handle in an allocated block whose head points back to the handle?
+            if ( !in_heap( ptr ) || !( getHeader( ptr ) & 1 ) ||
+                 ((uint64_t *)( ptr + ALIGNMENT/2 ))[HANDLE_SLOT] != (uint64_t)&node[i] )
+            {
+                fprintf( stderr, "The handle %p does not match its payload at %p.\n", (void *)&node[i], (void *)node[i] );
+                return false;
+            }
+        }
+    }
+
+    // Does every empty slot of the handle table lie on the stack of empty slots?
+    for ( uint64_t *slot = handleEmpty; slot; slot = (uint64_t *)( *slot & ~1ull ) )
+        --handles;
+    if ( handles )
+    {
+        fprintf( stderr, "The handle table loses empty slots.\n" );
+        return false;
+    }
+
+#endif /* DEBUG */
     return true;
 }
 
+#ifndef DRIVER
+/*
+ * The multi-arena build for interpositioning: make libmm.so, and LD_PRELOAD it.
+ * Every thread is bound to one of NUM_ARENAS arenas, which own their slabs, and
+ * keeps up to CACHE_MAX free objects of each slab class for itself. An object
+ * that a thread of another arena frees goes back to its arena through a
+ * lock-free stack, which the arena empties the next time it fills a cache.
+ * The blocks and the heap are shared by the arenas under heapMutex.
+ */
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#undef posix_memalign
+#undef aligned_alloc
+#undef memalign
+#undef malloc_usable_size
+#undef mm_malloc_batch
+#undef mm_free_batch
+#undef mm_halloc
+#undef mm_hlock
+#undef mm_hunlock
+#undef mm_hfree
+#undef mm_compact
+#undef mm_malloc_hint
+
+#define NUM_ARENAS 8          // The number of arenas
+#define CACHE_MAX 32          // The largest number of free objects in the cache of a class
+#define CACHE_BATCH 8         // The number of objects a cache takes from its arena at a time
+
+struct arena
+{
+    pthread_mutex_t lock; // The lock of the slabs of the arena
+    uint64_t **dirs; // The slab directories of the arena
+    char *remote; // The objects that other arenas freed, linked through their first word
+    unsigned threads; // The number of live threads bound to the arena
+};
+
+struct arena *arenas; // The arenas, at the beginning of the heap
+unsigned arenaNext; // The number of threads that have been bound to an arena
+pthread_once_t heapOnce = PTHREAD_ONCE_INIT; // The initialization of the heap
+pthread_key_t cacheKey; // The key whose destructor gives back the cache of a thread
+MM_LOCAL struct arena *arena; // The arena of the thread
+MM_LOCAL char *cacheHeads[SLAB_CLASSES]; // The free objects of each class cached by the thread
+MM_LOCAL uint8_t cacheCounts[SLAB_CLASSES]; // The number of cached objects of each class
+
+static void arenaDrain( struct arena *owner );
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheFlush
+// Description  : Give the cached objects of a class back to the slabs of the
+//                arena, until only some of them are left
+//
+// Inputs       : cls - the slab class
+//                keep - the number of objects to keep
+// Outputs      : nothing
+static void cacheFlush( uint8_t cls, uint8_t keep )
+{
+    pthread_mutex_lock( &arena->lock );
+    while ( cacheCounts[cls] > keep )
+    {
+        char *obj = cacheHeads[cls]; // The object to give back
+        cacheHeads[cls] = *(char **)obj;
+        --cacheCounts[cls];
+        slabDelete( slabFind( obj ), obj );
+    }
+    pthread_mutex_unlock( &arena->lock );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheExit
+// Description  : Give the whole cache of an exiting thread back to its arena,
+//                with the objects that other arenas freed
+//
+// Inputs       : value - the arena of the thread
+// Outputs      : nothing
+static void cacheExit( void *value )
+{
+    for ( int cls = 0; cls < SLAB_CLASSES; ++cls )
+        cacheFlush( cls, 0 );
+
+    pthread_mutex_lock( &arena->lock );
+    arenaDrain( arena );
+    __atomic_sub_fetch( &arena->threads, 1, __ATOMIC_SEQ_CST );
+    pthread_mutex_unlock( &arena->lock );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : heapStart
+// Description  : Initialize the heap and the arenas, once for the process
+//
+// Inputs       : nothing
+// Outputs      : nothing
+static void heapStart( void )
+{
+    pthread_mutexattr_t attr; // A recursive lock, since realloc() calls malloc() and free()
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+    pthread_mutex_init( &heapMutex, &attr );
+    pthread_mutexattr_destroy( &attr );
+
+    mem_init();
+    arenas = mem_sbrk( NUM_ARENAS*sizeof(struct arena) );
+    for ( int i = 0; i < NUM_ARENAS; ++i )
+    {
+        pthread_mutex_init( &arenas[i].lock, NULL );
+        arenas[i].remote = NULL;
+        arenas[i].threads = 0;
+        arenas[i].dirs = NULL;
+
+        // The first arena takes the directories of mm_init()
+        if ( i )
+        {
+            arenas[i].dirs = mem_sbrk( SLAB_CLASSES*sizeof(uint64_t *) );
+            for ( int index = 0; index < SLAB_CLASSES; ++index )
+                arenas[i].dirs[index] = NULL;
+        }
+    }
+    mm_init();
+    arenas[0].dirs = slabDirs;
+
+    // The bitmap of slab pages covers the largest heap from the start, so that it
+    // never moves while other arenas look it up
+    slabPageWords = MAX_HEAP_SIZE / SLAB_BYTES / 64;
+    slabPages = mmap( NULL, slabPageWords*sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+
+    pthread_key_create( &cacheKey, cacheExit );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arenaBind
+// Description  : Bind the thread to the next arena, round robin, and take the
+//                objects that were freed while no thread was bound to it
+//
+// Inputs       : nothing
+// Outputs      : nothing
+static void arenaBind( void )
+{
+    pthread_once( &heapOnce, heapStart );
+    arenaId = __atomic_fetch_add( &arenaNext, 1, __ATOMIC_RELAXED ) % NUM_ARENAS;
+    arena = &arenas[arenaId];
+    slabDirs = arena->dirs;
+    pthread_setspecific( cacheKey, arena );
+
+    pthread_mutex_lock( &arena->lock );
+    __atomic_add_fetch( &arena->threads, 1, __ATOMIC_SEQ_CST );
+    arenaDrain( arena );
+    pthread_mutex_unlock( &arena->lock );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arenaDrain
+// Description  : Give the objects that other arenas freed back to the slabs of
+//                an arena, whose lock is held
+//
+// Inputs       : owner - the arena
+// Outputs      : nothing
+static void arenaDrain( struct arena *owner )
+{
+    char *obj = __atomic_exchange_n( &owner->remote, NULL, __ATOMIC_ACQUIRE ); // The freed objects
+    uint64_t **dirs = slabDirs; // The directories of the thread, while those of the owner are used
+
+    slabDirs = owner->dirs;
+    while ( obj )
+    {
+        char *next = *(char **)obj; // The next freed object
+        slabDelete( slabFind( obj ), obj );
+        obj = next;
+    }
+    slabDirs = dirs;
+    return;
+}
+
 /*
  * malloc
  */
+__attribute__(( visibility( "default" ) ))
 void *malloc( size_t size )
 {
-    /* IMPLEMENT THIS */
-    char *ptr = NULL; // A pointer to save the address
+    // Check the thread is not bound to an arena yet
+    if ( !arena )
+        arenaBind();
 
-    // Check the size of the block is less than or equal to 32
-    if ( size <= ALIGNMENT )
-        ptr = slabAdd( ALIGNMENT );
-    else if ( size <= 2*ALIGNMENT )
-        ptr = slabAdd( 2*ALIGNMENT );
+    // Check the size is too large for the slabs
+    if ( size > SLAB_MAX )
+    {
+        // Check the size of the block overflows
+        if ( size > SIZE_MAX/2 )
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
 
-    // Check the pointer is not null
-    if ( ptr )
+        heapLock();
+        ++blockAllocs[getIndex( blockSize( size ) )];
+        void *ptr = blockAdd( size );
+        heapUnlock();
         return ptr;
+    }
 
-    size_t newsize = align(size) + ALIGNMENT; // The size of the block
-    uint8_t index = getIndex( newsize ); // The index of the block in segregate free list
+    uint8_t cls = slabClass( size ); // The slab class
 
-    // Loop through the free lists and find the best fit
-    for ( int i = index; i < 36; ++i )
+    // Check the cache is empty, and fill it from the slabs of the arena
+    if ( !cacheHeads[cls] )
     {
-        uint64_t difference = (1ull*(1ull<<40)); // The difference of the size
-        char *best = NULL; // The pointer to save the best block
-        size_t bestSize = 0; // The best block's size
-        char *bestPred = NULL; // The best block's predecessor
-        char *bestSucc = NULL; // The best block's successor
-        ptr = lists[i]; 
-
-        // Check the pointer is not null
-        while ( ptr )
+        pthread_mutex_lock( &arena->lock );
+        arenaDrain( arena );
+        while ( cacheCounts[cls] < CACHE_BATCH )
         {
-            uint8_t isValid = 1; // the status of valid
-            size_t size = 0; // the size of the block that the pointer points to 
-            char *pred = NULL;// the predecessor of the block that the pointer points to
-            char *succ = NULL;// the successor of the block that the pointer points to
-            getBlockInfo( ptr, NULL, &isValid, &size, &pred, &succ );
+            char *obj = slabAdd( size, false ); // A new object
 
-            // Chenck the block is free and the size is greater than the new size
-            if ( !isValid && size >= newsize )
-            {
-                // Check the difference of the sizes is less than the difference that recorded before
-                if ( size - newsize < difference )
-                {
-                    difference = size - newsize;
-                    best = ptr;
-                    bestSize = size;
-                    bestPred = pred;
-                    bestSucc = succ;
-                }
+            // Check there is no memory for more objects
+            if ( !obj )
+                break;
 
-                // Check the difference is 0
-                if ( !difference )
-                    break;
-            }
-            ptr = succ;
+            *(char **)obj = cacheHeads[cls];
+            cacheHeads[cls] = obj;
+            ++cacheCounts[cls];
         }
+        pthread_mutex_unlock( &arena->lock );
 
-        // Check the best pointer is not null
-        if ( best )
-        {
-            listDelete( bestPred, bestSucc, i );
-            addTags( best, 1, newsize, NULL, NULL );
-
-            // Check the differences of the bestSize and the newsize is greater than or equal to 32
-            if ( bestSize - newsize >= 2*ALIGNMENT )
-            {
-                addTags( best + newsize, 0, difference, NULL, NULL );
-                listAdd( best + newsize, getIndex( difference ) );
-            }
-            else if ( bestSize > newsize )
-            {
-                addTags( best + newsize, 0, difference, NULL, NULL );
-            }
-            return best + ALIGNMENT/2;
-        }
+        // Check the cache is still empty
+        if ( !cacheHeads[cls] )
+            return NULL;
     }
 
-    ptr = mem_sbrk( newsize ) + ALIGNMENT/2;
-    addTags( ptr - ALIGNMENT/2, 1, newsize, NULL, NULL );
-    return ptr;
+    char *obj = cacheHeads[cls]; // The cached object
+    cacheHeads[cls] = *(char **)obj;
+    --cacheCounts[cls];
+    return obj;
+}
+
+/*
+ * mm_malloc_hint
+ * The thread caches hand out the objects of a class whatever their lifetimes,
+ * so the hint is not taken here.
+ */
+__attribute__(( visibility( "default" ) ))
+void *mm_malloc_hint( size_t size, int hint )
+{
+    return malloc( size );
 }
 
 /*
  * free
  */
+__attribute__(( visibility( "default" ) ))
 void free( void *ptr )
 {
-    /* IMPLEMENT THIS */
     // Check the pointer is not null
     if ( !ptr )
         return;
 
-    // Loop through the slab16
-    for (int i = 0; i < 10; ++i)
-    {
-        int num = ( (i & 0) | 1 ) << i; // The bymber of bitmap
+    // Check the thread is not bound to an arena yet
+    if ( !arena )
+        arenaBind();
 
-        // Check the index is greater than 8
-        if ( i > 8 )
-            num = 32;
-        else
-            num = 8;
+    uint64_t *slab = slabFind( ptr ); // The slab that holds the object
 
-        // If ptr points to a location in a slab
-        if ( (char *)ptr > slabs16[i] &&
-             (char *)ptr < slabs16[i] + num*1024 + num * ALIGNMENT/2 )
-        {
-            slabDelete( ptr, ALIGNMENT, i );
-            return;
-        }
+    // Check the pointer is a block
+    if ( !slab )
+    {
+        heapLock();
+        blockFree( ptr );
+        heapUnlock();
+        return;
     }
 
-    // Loop through the slab32
-    for (int i = 0; i < 14; ++i)
-    {
-        int num = ( (i & 0) | 1 ) << i; // The bumber of bitmap
+    struct arena *owner = &arenas[slab[SLAB_INFO] >> 32]; // The arena of the slab
 
-        // Check the index is greater than 8
-        if ( i > 8 )
-            num = 32;
-        else
-            num = 8;
+    // Check another arena owns the slab, and push the object onto its stack
+    if ( owner != arena )
+    {
+        char *head = __atomic_load_n( &owner->remote, __ATOMIC_RELAXED ); // The top of the stack
+        do
+        {
+            *(char **)ptr = head;
+        }
+        while ( !__atomic_compare_exchange_n( &owner->remote, &head, ptr, true,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) );
 
-        // If ptr points to a location in a slab
-        if ( (char *)ptr > slabs32[i] &&
-             (char *)ptr < slabs32[i] + num*2048 + num * ALIGNMENT/2 )
+        // Check no thread is bound to the owner any more, which would never drain
+        // the stack, and drain it here
+        if ( !__atomic_load_n( &owner->threads, __ATOMIC_SEQ_CST ) )
         {
-            slabDelete( ptr, 2*ALIGNMENT, i );
-            return;
+            pthread_mutex_lock( &owner->lock );
+            arenaDrain( owner );
+            pthread_mutex_unlock( &owner->lock );
         }
+        return;
     }
 
-    uint8_t isValid = 1; // The valid status of the block that ptr points to
-    size_t size = 0; // The size of the block that ptr points to
-    getBlockInfo( (char *)ptr - ALIGNMENT/2, NULL, &isValid, &size, NULL, NULL );
+    uint8_t cls = slab[SLAB_INFO] & 0xff; // The slab class
+    *(char **)ptr = cacheHeads[cls];
+    cacheHeads[cls] = ptr;
 
-    // Check the ptr is free
-    if ( isValid != 1 )
-        return;
+    // Check the cache is too full, and give half of it back
+    if ( ++cacheCounts[cls] > CACHE_MAX )
+        cacheFlush( cls, CACHE_MAX/2 );
+    return;
+}
 
-    uint8_t isPreValid = 1; // The valid status of the previous block that ptr points to
-    size_t preSize = 0; // The size of the previous block
-    char *prePred = NULL; // The predecessor of the previous block
-    char *preSucc = NULL; // The successor of the previous block
+/*
+ * realloc
+ */
+__attribute__(( visibility( "default" ) ))
+void *realloc( void *oldptr, size_t size )
+{
+    // Check the old pointer is null, which is the same as malloc()
+    if ( !oldptr )
+        return malloc( size );
 
-    // Check the previous block is in heap
-    if ( in_heap( (char *)ptr - ALIGNMENT -1 ) )
+    // Check the new size is 0, which is the same as free()
+    if ( !size )
     {
-        getBlockInfo( NULL, (char *)ptr - ALIGNMENT/2, &isPreValid, &preSize,
-                      &prePred, &preSucc );
+        free( oldptr );
+        return NULL;
     }
 
-    uint8_t isPostValid = 1; // The valid status of the post block that ptr points to
-    size_t postSize = 0; // The size of the post block
-    char *postPred = NULL; // The predecessor of the post block
-    char *postSucc = NULL; // The successor of the post block
-
-    // Check the post block is in heap
-    if ( in_heap( (char *)ptr + size ) )
+    // Check the size of the new block overflows, and keep the old object
+    if ( size > SIZE_MAX/2 )
     {
-        getBlockInfo( (char *)ptr + size - ALIGNMENT/2, NULL, &isPostValid, &postSize,
-                      &postPred, &postSucc );
+        errno = ENOMEM;
+        return NULL;
     }
-        
-    // Check the previous block is free
-    if ( isPreValid == 0 )
-    {
-        //Check the post block is free
-        if ( isPostValid == 0 )
-        {
-            size += postSize;
-
-            // Check the size of the post block is less than16
-            if ( postSize > ALIGNMENT )
-            {
-                listDelete( postPred, postSucc, getIndex(postSize) );
-                getBlockInfo( NULL, (char *)ptr - ALIGNMENT/2, &isPreValid, &preSize,
-                    &prePred, &preSucc );
-            }
-        }
 
-        size += preSize;
+    // Check the thread is not bound to an arena yet
+    if ( !arena )
+        arenaBind();
 
-        // Check the size of the previous block is greater than 16
-        if ( preSize > ALIGNMENT )
-            listDelete( prePred, preSucc, getIndex(preSize) );
+    uint64_t *slab = slabFind( oldptr ); // The slab that holds the old object
 
-        addTags( (char *)ptr - ALIGNMENT/2 - preSize, 0, size, NULL, NULL );
-        listAdd( (char *)ptr - ALIGNMENT/2 - preSize, getIndex(size) );       
-    }
-    else if ( isPostValid == 0 )
+    // Check the old pointer is an object, which cannot grow in place
+    if ( slab )
     {
-        size += postSize;
+        size_t oldsize = slabSize( slab ); // The size of the old object
 
-        // Check the size of the post block is greater than 16
-        if ( postSize > ALIGNMENT )
-            listDelete( postPred, postSucc, getIndex(postSize) );
+        if ( size <= oldsize && size > oldsize - ALIGNMENT )
+            return oldptr;
 
-        addTags( (char *)ptr - ALIGNMENT/2, 0, size, NULL, NULL );
-        listAdd( (char *)ptr - ALIGNMENT/2, getIndex(size) );
-    }
-    else if ( isPreValid == 1 && isPostValid == 1 )
-    {
-        addTags( (char *)ptr - ALIGNMENT/2, 0, size, NULL, NULL );
+        void *ptr = malloc( size );
 
-        // Check the size of the block is greater than 16
-        if ( size > ALIGNMENT )
-            listAdd( (char *)ptr - ALIGNMENT/2, getIndex(size) );
+        // Check there is no memory for the new object, and keep the old one
+        if ( !ptr )
+            return NULL;
+
+        memcpy( ptr, oldptr, size < oldsize ? size : oldsize );
+        free( oldptr );
+        return ptr;
     }
 
-    return;
+    // A block may move into the slabs of the arena, so lock the arena first
+    pthread_mutex_lock( &arena->lock );
+    heapLock();
+    void *ptr = arena_realloc( oldptr, size );
+    heapUnlock();
+    pthread_mutex_unlock( &arena->lock );
+    return ptr;
 }
 
 /*
- * realloc
+ * calloc
  */
-void *realloc( void *oldptr, size_t size )
+__attribute__(( visibility( "default" ) ))
+void *calloc( size_t nmemb, size_t size )
 {
-    /* IMPLEMENT THIS */    
-    if ( !in_heap(oldptr) )
+    // Check the size overflows
+    if ( nmemb && size > SIZE_MAX / nmemb )
         return NULL;
 
-    // If oldptr points to a location in the slabs, 
-    // manipulate the bitmap of the slab correspondingly and reallocate the payload.
-    for (int i = 0; i < 10; ++i)
+    // Check the payload is a block, which arena_calloc() clears as little of as it
+    // can, while the heap lock keeps zeroFrom still
+    if ( nmemb*size > SLAB_MAX )
     {
-        int num = ( (i & 0) | 1 ) << i;
-        if ( i > 8 )
-            num = 32;
-        else
-            num = 8;
-        if ( (char *)oldptr > slabs16[i] &&
-             (char *)oldptr < slabs16[i] + num*1024 + num * ALIGNMENT/2 )
-        {
-            if ( size <= ALIGNMENT )
-                return oldptr;
+        heapLock();
+        void *ptr = arena_calloc( nmemb, size );
+        heapUnlock();
+        return ptr;
+    }
 
-            slabDelete( oldptr, ALIGNMENT, i );
-            char *ptr = malloc( size );
-            mem_memcpy( ptr, oldptr, ALIGNMENT );
-            return ptr;
-        }
+    void *ptr = malloc( nmemb*size );
+    if ( ptr )
+        memset( ptr, 0, nmemb*size );
+    return ptr;
+}
+
+__attribute__(( visibility( "default" ) ))
+void *memalign( size_t alignment, size_t size )
+{
+    // Check the payload is a block, which only the heap lock guards
+    if ( alignment > ALIGNMENT )
+    {
+        pthread_once( &heapOnce, heapStart );
+        heapLock();
+        void *ptr = arena_memalign( alignment, size );
+        heapUnlock();
+        return ptr;
     }
 
-    for (int i = 0; i < 14; ++i)
+    // Check the alignment is a power of two
+    if ( !alignment || ( alignment & ( alignment - 1 ) ) )
     {
-        int num = ( (i & 0) | 1 ) << i;
-        if ( i > 8 )
-            num = 32;
-        else
-            num = 8;
-        if ( (char *)oldptr > slabs32[i] &&
-             (char *)oldptr < slabs32[i] + num*2048 + num * ALIGNMENT/2 )
-        {
-            if ( size > ALIGNMENT && size <= ALIGNMENT*2 )
-                return oldptr;
+        errno = EINVAL;
+        return NULL;
+    }
+    return malloc( size );
+}
+
+__attribute__(( visibility( "default" ) ))
+int posix_memalign( void **memptr, size_t alignment, size_t size )
+{
+    // Check the alignment is a power of two and a multiple of the size of a pointer
+    if ( !alignment || ( alignment & ( alignment - 1 ) ) || alignment % sizeof(void *) )
+        return EINVAL;
 
-            slabDelete( oldptr, 2*ALIGNMENT, i );
-            char *ptr = malloc( size );
-            if ( size <= ALIGNMENT )
-                mem_memcpy( ptr, oldptr, ALIGNMENT );
-            else
-                mem_memcpy( ptr, oldptr, 2*ALIGNMENT );
+    void *ptr = memalign( alignment, size ); // The aligned payload
 
-            return ptr;
-        }
-    }
+    // Check the heap is out of memory
+    if ( !ptr )
+        return ENOMEM;
 
-    // If oldptr does not point to a location in the slabs:
-    uint8_t isOldValid = 1;
-    size_t oldsize = 0;
-    getBlockInfo( (char *)oldptr - ALIGNMENT/2, NULL, &isOldValid, &oldsize, NULL, NULL );
+    *memptr = ptr;
+    return 0;
+}
 
-    if ( isOldValid != 1 )
-        return NULL;
+__attribute__(( visibility( "default" ) ))
+void *aligned_alloc( size_t alignment, size_t size )
+{
+    return memalign( alignment, size );
+}
 
-    size_t newsize = align(size) + ALIGNMENT;
-    
-    // If the old size is the same as the new size, do nothing.
-    if ( oldsize == newsize )
-        return oldptr;
+__attribute__(( visibility( "default" ) ))
+size_t malloc_usable_size( void *ptr )
+{
+    return arena_malloc_usable_size( ptr );
+}
 
-    // If the old size is greater than the new size, 
-    // free the redundant space at the end using the free() function.
-    else if ( oldsize > newsize )
-    {
-        char temp[size];
-        mem_memcpy( temp, oldptr, size );
-        addTags( (char *)oldptr - ALIGNMENT/2, 1, newsize, NULL, NULL );
-        addTags( (char *)oldptr - ALIGNMENT/2 + newsize, 1, oldsize - newsize,
-            NULL, NULL );
-        free( (char *)oldptr + newsize );
-        mem_memcpy( oldptr, temp, size );
-        return oldptr;
-    }
+__attribute__(( visibility( "default" ) ))
+size_t mm_malloc_batch( size_t size, size_t n, void **out )
+{
+    // Check the thread is not bound to an arena yet
+    if ( !arena )
+        arenaBind();
 
-    // If the old size is smaller than the new size, 
-    // copy the content of the payload, free the old pointer, 
-    // allocate a new payload of the new size, and paste the content to the new payload.
-    else
-    {
-        char temp[oldsize - ALIGNMENT];
-        mem_memcpy( temp, oldptr, oldsize - ALIGNMENT );
-        free( oldptr );
-        char *ptr = malloc( size );
-        mem_memcpy( ptr, temp, oldsize - ALIGNMENT );
-        return ptr;
-    }
+    // The slabs of the arena are taken straight, past the cache of the thread
+    pthread_mutex_lock( &arena->lock );
+    arenaDrain( arena );
+    size_t got = arena_malloc_batch( size, n, out );
+    pthread_mutex_unlock( &arena->lock );
+    return got;
 }
 
-/*
- * calloc
- * This function is not tested by mdriver, and has been implemented for you.
- */
-void* calloc(size_t nmemb, size_t size)
+__attribute__(( visibility( "default" ) ))
+void mm_free_batch( void **ptrs, size_t n )
 {
-    void* ptr;
-    size *= nmemb;
-    ptr = malloc(size);
-    if (ptr) {
-        memset(ptr, 0, size);
-    }
-    return ptr;
+    // The payloads may belong to other arenas, so they go through free(), whose
+    // cache gives them back to their slabs in batches already
+    for ( size_t i = 0; i < n; ++i )
+        free( ptrs[i] );
+    return;
 }
 
-/*
- * Returns whether the pointer is in the heap.
- * May be useful for debugging.
- */
-static bool in_heap(const void* p)
+__attribute__(( visibility( "default" ) ))
+void **mm_halloc( size_t size )
 {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+    pthread_once( &heapOnce, heapStart );
+    return arena_halloc( size );
 }
 
-/*
- * Returns whether the pointer is aligned.
- * May be useful for debugging.
- */
-static bool aligned(const void* p)
+__attribute__(( visibility( "default" ) ))
+void *mm_hlock( void **handle )
 {
-    size_t ip = (size_t) p;
-    return align(ip) == ip;
+    return arena_hlock( handle );
 }
 
-/*
- * mm_checkheap
- * Check the heap for the followings:
- *   1. Is every payload aligned with 16?
- *   2. Are there contiguous free blocks that escape coalescing?
- *   3. Is there any free block not in free lists?
- *   4. Is every free block actually in free lists?
- *   5. Is every block in the free lists actually free?
- */
-bool mm_checkheap(int lineno)
+__attribute__(( visibility( "default" ) ))
+void mm_hunlock( void **handle )
 {
-#ifdef DEBUG
-    /* Write code to check heap invariants here */
-    /* IMPLEMENT THIS */
-    char *preBlock = NULL;
-    char *ptr = mem_heap_lo() + ALIGNMENT/2*(36+12+13); // make ptr points to the first block
-    uint8_t isPreValid = 1;
-    uint8_t isValid = 1;
-    size_t size = 0;
-    while ( ptr < (char *)mem_heap_hi() )
-    {
-        // Is every payload aligned with 16?
-        if ( !aligned( ptr + ALIGNMENT/2 ) )
-        {
-            fprintf( stderr, "Payload of the block %p is not in aligned.\n", ptr );
-            return false;
-        }
+    arena_hunlock( handle );
+    return;
+}
 
-        // Are there contiguous free blocks that escape coalescing?
-        getBlockInfo( ptr, NULL, &isValid, &size, NULL, NULL );
-        if ( isPreValid == isValid && isPreValid == 0 )
-        {
-            fprintf( stderr, "Contiguous free blocks %p and %p escape coalescing.\n",
-                preBlock, ptr );
-            return false;
-        }
+__attribute__(( visibility( "default" ) ))
+void mm_hfree( void **handle )
+{
+    arena_hfree( handle );
+    return;
+}
 
-        // Is every free block actually in free lists?
-        if ( !isValid && size > ALIGNMENT )
-        {
-            bool found = false;
-            char *tmp = lists[getIndex(size)];
-            char *succ = NULL;
-            while ( tmp )
-            {
-                getBlockInfo( tmp, NULL, NULL, NULL, NULL, &succ );
-                if ( tmp == ptr )
-                {
-                    found = true;
-                    break;
-                }
-                tmp = succ;
-            }
-            if ( !found )
-            {
-                fprintf( stderr, "Free block %p is not in free lists.\n", ptr );
-                return false;
-            }
-        }
-        isPreValid = isValid;
-        preBlock = ptr;
-        ptr += size;
-    }
+__attribute__(( visibility( "default" ) ))
+size_t mm_compact( void )
+{
+    pthread_once( &heapOnce, heapStart );
+    return arena_compact();
+}
 
-    char *succ = NULL;
+__attribute__(( visibility( "default" ) ))
+void mm_stats( struct mm_stats *stats )
+{
+    pthread_once( &heapOnce, heapStart );
+    memset( stats, 0, sizeof(*stats) );
 
-    for ( int i = 0; i < 36; ++i )
+    // Add up the slabs of every arena under its own lock, then the blocks
+    for ( int i = 0; i < NUM_ARENAS; ++i )
     {
-        ptr = lists[i];
-        while ( ptr )
-        {
-            // Is every block in the free lists actually free?
-            getBlockInfo( ptr, NULL, &isValid, NULL, NULL, &succ );
-            if ( isValid )
-            {
-                fprintf( stderr, "Block %p in free list %d is not marked free.\n", ptr, i );
-                return false;
-            }
-            ptr = succ;
-        }
+        pthread_mutex_lock( &arenas[i].lock );
+        statsSlabs( arenas[i].dirs, stats );
+        pthread_mutex_unlock( &arenas[i].lock );
     }
-
-#endif /* DEBUG */
-    return true;
+    heapLock();
+    statsBlocks( stats );
+    heapUnlock();
+    return;
 }
+#endif /* DRIVER */
@@ -8,6 +8,10 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern int mm_posix_memalign (void **memptr, size_t alignment, size_t size);
+extern void *mm_aligned_alloc (size_t alignment, size_t size);
+extern void *mm_memalign (size_t alignment, size_t size);
+extern size_t mm_malloc_usable_size (void *ptr);
 
 #else
 
@@ -16,10 +20,83 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern int posix_memalign (void **memptr, size_t alignment, size_t size);
+extern void *aligned_alloc (size_t alignment, size_t size);
+extern void *memalign (size_t alignment, size_t size);
+extern size_t malloc_usable_size (void *ptr);
 
 #endif
 
 extern bool mm_init(void);
 
+/* Allocate or free many payloads at once */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* Set how many slab classes, the busiest ones, take new objects at once */
+extern void mm_set_slab_classes(unsigned count);
+
+/* Placement policies of the free lists, set by mm_set_policy() for the next mm_init() */
+#define MM_BEST_FIT 0    /* The smallest block that fits */
+#define MM_FIRST_FIT 1   /* The first block that fits, from the most recently freed */
+#define MM_NEXT_FIT 2    /* The first block that fits, from where the last search stopped */
+#define MM_ADDRESS_FIT 3 /* The first block that fits, in lists ordered by address */
+#define MM_GOOD_FIT 4    /* The smallest of the first few blocks that fit */
+#define MM_POLICIES 5
+
+extern void mm_set_policy(int policy);
+
+/* Backends of the payloads that are not in slabs, set by mm_set_backend() for the next mm_init().
+   Building with -DBUDDY makes the buddy blocks the default */
+#define MM_SEGREGATED 0  /* Segregated free lists of blocks that coalesce, placed by the policy */
+#define MM_BUDDY 1       /* Binary buddy blocks of powers of two, without footers */
+
+extern void mm_set_backend(int backend);
+
+/* Expected lifetimes of a payload, the hints of mm_malloc_hint() */
+#define MM_SHORT 1 /* Freed soon, kept apart from the others */
+#define MM_LONG 2  /* Kept for long */
+
+extern void *mm_malloc_hint(size_t size, int hint);
+
+/* Set whether payloads of different lifetimes are kept apart, for the next mm_init() */
+extern void mm_set_lifetimes(bool segregate);
+
+/* Relocatable payloads, reached through handles. The payload is at *handle until mm_compact() moves it,
+   which it does not while the handle is locked */
+extern void **mm_halloc(size_t size);
+extern void *mm_hlock(void **handle);
+extern void mm_hunlock(void **handle);
+extern void mm_hfree(void **handle);
+
+/* Slide the unlocked payloads of handles together and trim the heap. Returns the bytes given back */
+extern size_t mm_compact(void);
+
+/* Counters of what the allocator is doing, filled in by mm_stats() */
+#define MM_SLAB_CLASSES 32 /* The slab classes, of objects of 16, 32, ..., 512 bytes */
+#define MM_LIST_CLASSES 29 /* The free lists, of blocks from (4 + i%4) << (3 + i/4) bytes; the last one holds 4096 or more */
+
+struct mm_stats {
+    size_t slabAllocs[MM_SLAB_CLASSES];  /* Objects allocated in the slabs of each class */
+    size_t slabFrees[MM_SLAB_CLASSES];   /* Objects freed back to the slabs of each class */
+    size_t slabCount[MM_SLAB_CLASSES];   /* Slabs of each class */
+    size_t slabUsed[MM_SLAB_CLASSES];    /* Objects allocated in the slabs of each class now */
+    size_t blockAllocs[MM_LIST_CLASSES]; /* Blocks allocated, by the class of their size */
+    size_t blockFrees[MM_LIST_CLASSES];  /* Blocks freed, by the class of their size */
+    size_t freeBlocks[MM_LIST_CLASSES];  /* Blocks in each free list */
+    size_t freeBytes[MM_LIST_CLASSES];   /* Bytes of the blocks in each free list */
+    size_t heapBytes;     /* Bytes in the heap */
+    size_t slabBytes;     /* Bytes of the heap held by slabs */
+    size_t listBytes;     /* Bytes of the heap in the free lists */
+    size_t quickBytes;    /* Bytes of freed blocks waiting in the quick lists */
+    size_t largestFree;   /* Bytes of the largest block in the free lists */
+    double fragmentation; /* 1 - largestFree/listBytes, or 0 with nothing free */
+    size_t sbrkCalls;     /* Calls to mem_sbrk since the heap was reset */
+    unsigned long long slabHot; /* The bitmap of the slab classes that take new objects */
+};
+
+/* Fill in the counters. The preloaded build counts the slab objects that the thread caches take and give back */
+extern void mm_stats(struct mm_stats *stats);
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);